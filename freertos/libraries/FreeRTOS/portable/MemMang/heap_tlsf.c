@@ -0,0 +1,492 @@
+/*
+ * Two level segregated fit implementation of pvPortMalloc() and vPortFree().
+ *
+ * Free blocks are kept on segregated lists. The first level splits sizes by
+ * powers of 2, the second level splits each power of 2 range into
+ * tlsfSL_INDEX_COUNT equal classes. Two bitmaps record which lists are not
+ * empty, so a fitting list is found with a couple of count leading/trailing
+ * zero instructions instead of walking the free blocks. Every block records
+ * its physical predecessor, so a freed block is merged with its free
+ * neighbours right away. Allocation and free take constant time whatever the
+ * state of the heap.
+ *
+ * Select it with HEAP_IMPL = heap_tlsf in the Makefile. See heap_ww.c for the
+ * list walking allocator it replaces.
+ */
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Defining MPU_WRAPPERS_INCLUDED_FROM_API_FILE prevents task.h from redefining
+all the API functions to use the MPU wrappers.  That should only be done when
+task.h is included from an application file. */
+#define MPU_WRAPPERS_INCLUDED_FROM_API_FILE
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "heap_stats.h"
+
+#undef MPU_WRAPPERS_INCLUDED_FROM_API_FILE
+
+#ifndef configHEAP_HISTOGRAM
+#define configHEAP_HISTOGRAM 0
+#endif
+
+/* Second level classes per power of 2, log2 */
+#define tlsfSL_INDEX_COUNT_LOG2 3
+#define tlsfSL_INDEX_COUNT      ( 1 << tlsfSL_INDEX_COUNT_LOG2 )
+
+#if portBYTE_ALIGNMENT == 8
+    #define tlsfALIGN_LOG2 3
+#elif portBYTE_ALIGNMENT == 4
+    #define tlsfALIGN_LOG2 2
+#else
+    #error "heap_tlsf needs portBYTE_ALIGNMENT of 4 or 8"
+#endif
+
+/* Blocks below tlsfSMALL_BLOCK_SIZE all live on the first level list 0,
+   split linearly into tlsfSL_INDEX_COUNT classes. */
+#define tlsfFL_INDEX_SHIFT      ( tlsfSL_INDEX_COUNT_LOG2 + tlsfALIGN_LOG2 )
+#define tlsfSMALL_BLOCK_SIZE    ( ( size_t ) 1 << tlsfFL_INDEX_SHIFT )
+
+/* The heap has to be smaller than 2^tlsfFL_INDEX_MAX bytes */
+#ifndef tlsfFL_INDEX_MAX
+#define tlsfFL_INDEX_MAX        15
+#endif
+#define tlsfFL_INDEX_COUNT      ( tlsfFL_INDEX_MAX - tlsfFL_INDEX_SHIFT + 1 )
+
+typedef char xTlsfHeapFits[ ( configTOTAL_HEAP_SIZE < ( ( size_t ) 1 << tlsfFL_INDEX_MAX ) ) ? 1 : -1 ];
+
+/* Every block starts with the first two fields. The free list links are only
+   valid in free blocks and overlay the start of the payload otherwise. */
+typedef struct xTLSF_BLOCK
+{
+    struct xTLSF_BLOCK *pxPrevPhys;     /*<< The block just below this one in memory. */
+    size_t xSize;                       /*<< Whole block including this header, flags in the low bits. */
+    struct xTLSF_BLOCK *pxNextFree;
+    struct xTLSF_BLOCK *pxPrevFree;
+} xTlsfBlock;
+
+#define tlsfBLOCK_FREE          ( ( size_t ) 1 )
+#define tlsfBLOCK_PREV_FREE     ( ( size_t ) 2 )
+#define tlsfBLOCK_FLAGS         ( tlsfBLOCK_FREE | tlsfBLOCK_PREV_FREE )
+
+#define tlsfHEADER_SIZE         ( offsetof( xTlsfBlock, pxNextFree ) )
+#define tlsfMIN_BLOCK_SIZE      ( ( sizeof( xTlsfBlock ) + portBYTE_ALIGNMENT_MASK ) & ~( size_t ) portBYTE_ALIGNMENT_MASK )
+
+#define tlsfSIZE( pxBlock )     ( ( pxBlock )->xSize & ~tlsfBLOCK_FLAGS )
+#define tlsfNEXT( pxBlock )     ( ( xTlsfBlock * ) ( ( ( unsigned char * ) ( pxBlock ) ) + tlsfSIZE( pxBlock ) ) )
+
+/* Allocate the memory for the heap.  The union is used to force byte
+   alignment without using any non-portable code. */
+static union xRTOS_HEAP
+{
+#if portBYTE_ALIGNMENT == 8
+    volatile portDOUBLE dDummy;
+#else
+    volatile unsigned long ulDummy;
+#endif
+    unsigned char ucHeap[ configTOTAL_HEAP_SIZE ];
+} xHeap;
+
+static uint32_t ulFLBitmap;
+static uint32_t ulSLBitmap[ tlsfFL_INDEX_COUNT ];
+static xTlsfBlock *pxFreeLists[ tlsfFL_INDEX_COUNT ][ tlsfSL_INDEX_COUNT ];
+
+/* Keeps track of the number of free bytes remaining, but says nothing about
+   fragmentation. */
+static size_t xFreeBytesRemaining = 0;
+
+/* Kept up to date by malloc and free, so reading the statistics needs no
+   walk over the heap. */
+static size_t xMinimumEverFreeBytesRemaining = 0;
+static size_t xNumberOfFreeBlocks = 0;
+static size_t xNumberOfSuccessfulAllocations = 0;
+static size_t xNumberOfSuccessfulFrees = 0;
+static size_t xNumberOfFailedAllocations = 0;
+
+#if( configHEAP_HISTOGRAM == 1 )
+    static xHeapHistogram xHistogram;
+    #define tlsfHISTOGRAM_ADD( pxCounts, xSize, lDelta ) ( ( pxCounts )[ prvHistogramClass( xSize ) ] += ( lDelta ) )
+#else
+    #define tlsfHISTOGRAM_ADD( pxCounts, xSize, lDelta )
+#endif
+
+/*-----------------------------------------------------------*/
+
+/* Index of the most significant set bit, CLZ on Cortex-M3 */
+static inline int prvFls( size_t x )
+{
+    return ( int ) ( sizeof( unsigned long ) * 8 - 1 ) - __builtin_clzl( ( unsigned long ) x );
+}
+
+/* Index of the least significant set bit, RBIT and CLZ on Cortex-M3 */
+static inline int prvFfs( uint32_t x )
+{
+    return __builtin_ctz( x );
+}
+
+#if( configHEAP_HISTOGRAM == 1 )
+static inline int prvHistogramClass( size_t xSize )
+{
+    int iClass = prvFls( xSize );
+
+    return ( iClass < heapHISTOGRAM_CLASSES ) ? iClass : heapHISTOGRAM_CLASSES - 1;
+}
+#endif
+
+static inline void prvMappingInsert( size_t xSize, int *piFL, int *piSL )
+{
+    int iFL;
+
+    if( xSize < tlsfSMALL_BLOCK_SIZE )
+    {
+        *piFL = 0;
+        *piSL = ( int ) ( xSize >> ( tlsfFL_INDEX_SHIFT - tlsfSL_INDEX_COUNT_LOG2 ) );
+    }
+    else
+    {
+        iFL = prvFls( xSize );
+        *piSL = ( int ) ( xSize >> ( iFL - tlsfSL_INDEX_COUNT_LOG2 ) ) ^ tlsfSL_INDEX_COUNT;
+        *piFL = iFL - tlsfFL_INDEX_SHIFT + 1;
+    }
+}
+
+/* Rounds the size up to the next class, so that any block on the list that
+   is found is large enough without looking at it */
+static inline void prvMappingSearch( size_t xSize, int *piFL, int *piSL )
+{
+    if( xSize >= tlsfSMALL_BLOCK_SIZE )
+    {
+        xSize += ( ( size_t ) 1 << ( prvFls( xSize ) - tlsfSL_INDEX_COUNT_LOG2 ) ) - 1;
+    }
+    prvMappingInsert( xSize, piFL, piSL );
+}
+
+static xTlsfBlock *prvFindSuitable( int *piFL, int *piSL )
+{
+    uint32_t ulSLMap, ulFLMap;
+    int iFL = *piFL;
+
+    if( iFL >= tlsfFL_INDEX_COUNT )
+    {
+        return NULL;
+    }
+
+    ulSLMap = ulSLBitmap[ iFL ] & ( ~( uint32_t ) 0 << *piSL );
+    if( ulSLMap == 0 )
+    {
+        /* Nothing left in this power of 2, take the smallest larger one. */
+        ulFLMap = ( iFL + 1 < 32 ) ? ulFLBitmap & ( ~( uint32_t ) 0 << ( iFL + 1 ) ) : 0;
+        if( ulFLMap == 0 )
+        {
+            return NULL;
+        }
+        iFL = prvFfs( ulFLMap );
+        ulSLMap = ulSLBitmap[ iFL ];
+    }
+
+    *piFL = iFL;
+    *piSL = prvFfs( ulSLMap );
+    return pxFreeLists[ iFL ][ *piSL ];
+}
+
+static void prvInsertFree( xTlsfBlock *pxBlock )
+{
+    int iFL, iSL;
+    xTlsfBlock *pxHead;
+
+    prvMappingInsert( tlsfSIZE( pxBlock ), &iFL, &iSL );
+    pxHead = pxFreeLists[ iFL ][ iSL ];
+
+    pxBlock->pxNextFree = pxHead;
+    pxBlock->pxPrevFree = NULL;
+    if( pxHead != NULL )
+    {
+        pxHead->pxPrevFree = pxBlock;
+    }
+    pxFreeLists[ iFL ][ iSL ] = pxBlock;
+
+    ulFLBitmap |= ( uint32_t ) 1 << iFL;
+    ulSLBitmap[ iFL ] |= ( uint32_t ) 1 << iSL;
+
+    xNumberOfFreeBlocks++;
+    tlsfHISTOGRAM_ADD( xHistogram.ulFreeBlocks, tlsfSIZE( pxBlock ), 1 );
+}
+
+static void prvRemoveFree( xTlsfBlock *pxBlock )
+{
+    int iFL, iSL;
+
+    prvMappingInsert( tlsfSIZE( pxBlock ), &iFL, &iSL );
+
+    xNumberOfFreeBlocks--;
+    tlsfHISTOGRAM_ADD( xHistogram.ulFreeBlocks, tlsfSIZE( pxBlock ), -1 );
+
+    if( pxBlock->pxNextFree != NULL )
+    {
+        pxBlock->pxNextFree->pxPrevFree = pxBlock->pxPrevFree;
+    }
+    if( pxBlock->pxPrevFree != NULL )
+    {
+        pxBlock->pxPrevFree->pxNextFree = pxBlock->pxNextFree;
+    }
+    else
+    {
+        pxFreeLists[ iFL ][ iSL ] = pxBlock->pxNextFree;
+        if( pxBlock->pxNextFree == NULL )
+        {
+            ulSLBitmap[ iFL ] &= ~( ( uint32_t ) 1 << iSL );
+            if( ulSLBitmap[ iFL ] == 0 )
+            {
+                ulFLBitmap &= ~( ( uint32_t ) 1 << iFL );
+            }
+        }
+    }
+}
+
+/* Marks the block free or used in its own header and in its successor's */
+static inline void prvSetFree( xTlsfBlock *pxBlock, portBASE_TYPE xFree )
+{
+    xTlsfBlock *pxNext = tlsfNEXT( pxBlock );
+
+    if( xFree )
+    {
+        pxBlock->xSize |= tlsfBLOCK_FREE;
+        pxNext->xSize |= tlsfBLOCK_PREV_FREE;
+    }
+    else
+    {
+        pxBlock->xSize &= ~tlsfBLOCK_FREE;
+        pxNext->xSize &= ~tlsfBLOCK_PREV_FREE;
+    }
+}
+
+static void prvHeapInit( void )
+{
+    xTlsfBlock *pxFirst, *pxEnd;
+    size_t xSize;
+
+    /* One free block over the whole heap, followed by a header with no
+       payload that is always in use, so the last real block never has to
+       check for the end of the heap. */
+    xSize = ( configTOTAL_HEAP_SIZE - tlsfHEADER_SIZE ) & ~( size_t ) portBYTE_ALIGNMENT_MASK;
+
+    pxFirst = ( xTlsfBlock * ) xHeap.ucHeap;
+    pxFirst->pxPrevPhys = NULL;
+    pxFirst->xSize = xSize;
+
+    pxEnd = tlsfNEXT( pxFirst );
+    pxEnd->pxPrevPhys = pxFirst;
+    pxEnd->xSize = 0;
+
+    prvSetFree( pxFirst, pdTRUE );
+    prvInsertFree( pxFirst );
+    xFreeBytesRemaining = xSize;
+    xMinimumEverFreeBytesRemaining = xSize;
+}
+
+/*-----------------------------------------------------------*/
+
+void *pvPortMalloc( size_t xWantedSize )
+{
+    xTlsfBlock *pxBlock, *pxRest;
+    static portBASE_TYPE xHeapHasBeenInitialised = pdFALSE;
+    void *pvReturn = NULL;
+    int iFL, iSL;
+
+    /* The wanted size is increased so it can contain the block header, and
+       aligned.  Anything that can not possibly fit is refused up front so
+       the rounding below can not overflow. */
+    if( ( xWantedSize > 0 ) && ( xWantedSize < configTOTAL_HEAP_SIZE ) )
+    {
+        xWantedSize = ( xWantedSize + tlsfHEADER_SIZE + portBYTE_ALIGNMENT_MASK ) & ~( size_t ) portBYTE_ALIGNMENT_MASK;
+        if( xWantedSize < tlsfMIN_BLOCK_SIZE )
+        {
+            xWantedSize = tlsfMIN_BLOCK_SIZE;
+        }
+    }
+    else
+    {
+        xWantedSize = 0;
+    }
+
+    vTaskSuspendAll();
+    {
+        /* If this is the first call to malloc then the heap will require
+           initialisation to setup the list of free blocks. */
+        if( xHeapHasBeenInitialised == pdFALSE )
+        {
+            prvHeapInit();
+            xHeapHasBeenInitialised = pdTRUE;
+        }
+
+        if( xWantedSize > 0 )
+        {
+            prvMappingSearch( xWantedSize, &iFL, &iSL );
+            pxBlock = prvFindSuitable( &iFL, &iSL );
+
+            /* The rounded up class can be empty while the exact one holds a
+               block that is big enough, e.g. the whole free heap. Looking at
+               the head of that list keeps it constant time. */
+            if( pxBlock == NULL )
+            {
+                prvMappingInsert( xWantedSize, &iFL, &iSL );
+                pxBlock = pxFreeLists[ iFL ][ iSL ];
+                if( ( pxBlock != NULL ) && ( tlsfSIZE( pxBlock ) < xWantedSize ) )
+                {
+                    pxBlock = NULL;
+                }
+            }
+
+            if( pxBlock != NULL )
+            {
+                prvRemoveFree( pxBlock );
+
+                /* If the block is larger than required it can be split into
+                   two, the rest goes straight back on a free list. */
+                if( tlsfSIZE( pxBlock ) - xWantedSize >= tlsfMIN_BLOCK_SIZE )
+                {
+                    pxRest = ( xTlsfBlock * ) ( ( ( unsigned char * ) pxBlock ) + xWantedSize );
+                    pxRest->pxPrevPhys = pxBlock;
+                    pxRest->xSize = tlsfSIZE( pxBlock ) - xWantedSize;
+                    pxBlock->xSize = xWantedSize | ( pxBlock->xSize & tlsfBLOCK_PREV_FREE );
+                    tlsfNEXT( pxRest )->pxPrevPhys = pxRest;
+                    prvSetFree( pxRest, pdTRUE );
+                    prvInsertFree( pxRest );
+                }
+
+                prvSetFree( pxBlock, pdFALSE );
+                xFreeBytesRemaining -= tlsfSIZE( pxBlock );
+                if( xFreeBytesRemaining < xMinimumEverFreeBytesRemaining )
+                {
+                    xMinimumEverFreeBytesRemaining = xFreeBytesRemaining;
+                }
+                xNumberOfSuccessfulAllocations++;
+                tlsfHISTOGRAM_ADD( xHistogram.ulUsedBlocks, tlsfSIZE( pxBlock ), 1 );
+                pvReturn = ( void * ) ( ( ( unsigned char * ) pxBlock ) + tlsfHEADER_SIZE );
+            }
+        }
+
+        if( pvReturn == NULL )
+        {
+            xNumberOfFailedAllocations++;
+        }
+    }
+    xTaskResumeAll();
+
+#if( configUSE_MALLOC_FAILED_HOOK == 1 )
+    {
+        if( pvReturn == NULL )
+        {
+            extern void vApplicationMallocFailedHook( void );
+            vApplicationMallocFailedHook();
+        }
+    }
+#endif
+
+    return pvReturn;
+}
+/*-----------------------------------------------------------*/
+
+void vPortFree( void *pv )
+{
+    xTlsfBlock *pxBlock, *pxNeighbour;
+
+    if( pv == NULL )
+    {
+        return;
+    }
+
+    /* The memory being freed will have the block header immediately before
+       it. */
+    pxBlock = ( xTlsfBlock * ) ( ( ( unsigned char * ) pv ) - tlsfHEADER_SIZE );
+
+    vTaskSuspendAll();
+    {
+        xFreeBytesRemaining += tlsfSIZE( pxBlock );
+        xNumberOfSuccessfulFrees++;
+        tlsfHISTOGRAM_ADD( xHistogram.ulUsedBlocks, tlsfSIZE( pxBlock ), -1 );
+
+        /* Merge with the block above, then with the block below. */
+        pxNeighbour = tlsfNEXT( pxBlock );
+        if( pxNeighbour->xSize & tlsfBLOCK_FREE )
+        {
+            prvRemoveFree( pxNeighbour );
+            pxBlock->xSize += tlsfSIZE( pxNeighbour );
+        }
+
+        if( pxBlock->xSize & tlsfBLOCK_PREV_FREE )
+        {
+            pxNeighbour = pxBlock->pxPrevPhys;
+            prvRemoveFree( pxNeighbour );
+            pxNeighbour->xSize += tlsfSIZE( pxBlock );
+            pxBlock = pxNeighbour;
+        }
+
+        tlsfNEXT( pxBlock )->pxPrevPhys = pxBlock;
+        prvSetFree( pxBlock, pdTRUE );
+        prvInsertFree( pxBlock );
+    }
+    xTaskResumeAll();
+}
+/*-----------------------------------------------------------*/
+
+size_t xPortGetFreeHeapSize( void )
+{
+    return xFreeBytesRemaining;
+}
+/*-----------------------------------------------------------*/
+
+void vPortGetHeapStats( xHeapStats *pxHeapStats )
+{
+    xTlsfBlock *pxBlock;
+    size_t xLargest = 0;
+    int iFL;
+
+    vTaskSuspendAll();
+    {
+        /* The largest block is on the highest non-empty list, the blocks on
+           that one list are the only ones that have to be looked at. */
+        if( ulFLBitmap != 0 )
+        {
+            iFL = prvFls( ulFLBitmap );
+            pxBlock = pxFreeLists[ iFL ][ prvFls( ulSLBitmap[ iFL ] ) ];
+            for( ; pxBlock != NULL; pxBlock = pxBlock->pxNextFree )
+            {
+                if( tlsfSIZE( pxBlock ) > xLargest )
+                {
+                    xLargest = tlsfSIZE( pxBlock );
+                }
+            }
+        }
+
+        pxHeapStats->xAvailableHeapSpaceInBytes = xFreeBytesRemaining;
+        pxHeapStats->xSizeOfLargestFreeBlockInBytes = xLargest;
+        pxHeapStats->xNumberOfFreeBlocks = xNumberOfFreeBlocks;
+        pxHeapStats->xMinimumEverFreeBytesRemaining = xMinimumEverFreeBytesRemaining;
+        pxHeapStats->xNumberOfSuccessfulAllocations = xNumberOfSuccessfulAllocations;
+        pxHeapStats->xNumberOfSuccessfulFrees = xNumberOfSuccessfulFrees;
+        pxHeapStats->xNumberOfFailedAllocations = xNumberOfFailedAllocations;
+    }
+    xTaskResumeAll();
+}
+/*-----------------------------------------------------------*/
+
+void vPortGetHeapHistogram( xHeapHistogram *pxHistogram )
+{
+#if( configHEAP_HISTOGRAM == 1 )
+    vTaskSuspendAll();
+    *pxHistogram = xHistogram;
+    xTaskResumeAll();
+#else
+    memset( pxHistogram, 0, sizeof( *pxHistogram ) );
+#endif
+}
+/*-----------------------------------------------------------*/
+
+void vPortInitialiseBlocks( void )
+{
+    /* This just exists to keep the linker quiet. */
+}
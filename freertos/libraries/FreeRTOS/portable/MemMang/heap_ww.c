@@ -60,6 +60,8 @@
  * management pages of http://www.FreeRTOS.org for more information.
  */
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 
 /* Defining MPU_WRAPPERS_INCLUDED_FROM_API_FILE prevents task.h from redefining
 all the API functions to use the MPU wrappers.  That should only be done when
@@ -68,9 +70,14 @@ task.h is included from an application file. */
 
 #include "FreeRTOS.h"
 #include "task.h"
+#include "heap_stats.h"
 
 #undef MPU_WRAPPERS_INCLUDED_FROM_API_FILE
 
+#ifndef configHEAP_HISTOGRAM
+#define configHEAP_HISTOGRAM 0
+#endif
+
 /* The free list is actually two linked lists, both running through all unallocated blocks.
    The first list orders the free blocks by size, the number of bytes available for allocation
    starting with the smallest, and is used for parsimonious allocation. The second list orders
@@ -107,6 +114,32 @@ static xBlockLink xStartSize, xEnd;  /* xEnd must follow heap in physical memory
    fragmentation. */
 static size_t xFreeBytesRemaining = configTOTAL_HEAP_SIZE;
 
+static size_t xMinimumEverFreeBytesRemaining = configTOTAL_HEAP_SIZE;
+static size_t xNumberOfFreeBlocks = 0;
+static size_t xNumberOfSuccessfulAllocations = 0;
+static size_t xNumberOfSuccessfulFrees = 0;
+static size_t xNumberOfFailedAllocations = 0;
+
+/* Only the allocated blocks are counted as they come and go, the free ones
+   are counted by walking the free list when the histogram is read. */
+#if( configHEAP_HISTOGRAM == 1 )
+    static uint32_t ulUsedBlocks[ heapHISTOGRAM_CLASSES ];
+    #define heapHISTOGRAM_ADD( xSize, lDelta ) ( ulUsedBlocks[ prvHistogramClass( xSize ) ] += ( lDelta ) )
+
+    static int prvHistogramClass( size_t xSize )
+    {
+        int iClass = 0;
+
+        while( ( xSize >>= 1 ) != 0 && iClass < heapHISTOGRAM_CLASSES - 1 )
+        {
+            iClass++;
+        }
+        return iClass;
+    }
+#else
+    #define heapHISTOGRAM_ADD( xSize, lDelta )
+#endif
+
 /* STATIC FUNCTIONS ARE DEFINED AS MACROS TO MINIMIZE THE FUNCTION CALL DEPTH. */
 
 /*
@@ -137,7 +170,7 @@ static size_t xFreeBytesRemaining = configTOTAL_HEAP_SIZE;
         /* has a larger size than the block we are inserting. */        \
         for ( pxIterator = &xStartAddr;                                 \
               pxIterator->pxNextAddrBlock != &xEnd &&                   \
-                  (int) pxIterator->pxNextAddrBlock < (int) pxBlockToInsert; \
+                  ( uintptr_t ) pxIterator->pxNextAddrBlock < ( uintptr_t ) pxBlockToInsert; \
               pxIterator = pxIterator->pxNextAddrBlock )                \
         {                                                               \
             /* There is nothing to do here - just iterate to the correct position. */ \
@@ -146,6 +179,7 @@ static size_t xFreeBytesRemaining = configTOTAL_HEAP_SIZE;
         /* Update the address-ordered list to include the block being inserted in the correct position. */ \
         pxBlockToInsert->pxNextAddrBlock = pxIterator->pxNextAddrBlock; \
         pxIterator->pxNextAddrBlock = pxBlockToInsert;                  \
+        xNumberOfFreeBlocks++;                                          \
     }
 
 /*-----------------------------------------------------------*/
@@ -171,6 +205,7 @@ static size_t xFreeBytesRemaining = configTOTAL_HEAP_SIZE;
         pxFirstFreeBlock->xBlockSize = configTOTAL_HEAP_SIZE;           \
         pxFirstFreeBlock->pxNextSizeBlock = &xEnd;                      \
         pxFirstFreeBlock->pxNextAddrBlock = &xEnd;                      \
+        xNumberOfFreeBlocks = 1;                                        \
     }
 
 /*-----------------------------------------------------------*/
@@ -227,13 +262,14 @@ void *pvPortMalloc( size_t xWantedSize )
                 pvReturn = ( void * ) ( ( ( unsigned char * ) pxPreviousSizeBlock->pxNextSizeBlock ) +
                                         heapSTRUCT_SIZE );
 
-                while ((int) pxPreviousAddrBlock->pxNextAddrBlock < (int) pxBlock)
+                while (pxPreviousAddrBlock->pxNextAddrBlock != pxBlock)
                     pxPreviousAddrBlock = pxPreviousAddrBlock->pxNextAddrBlock;
 
                 /* This block is being returned for use so must be taken our of the
                    list of free blocks. */
                 pxPreviousSizeBlock->pxNextSizeBlock = pxBlock->pxNextSizeBlock;
                 pxPreviousAddrBlock->pxNextAddrBlock = pxBlock->pxNextAddrBlock;
+                xNumberOfFreeBlocks--;
 
                 /* If the block is larger than required it can be split into two. */
                 if ( ( pxBlock->xBlockSize - xWantedSize ) > heapMINIMUM_BLOCK_SIZE )
@@ -253,8 +289,19 @@ void *pvPortMalloc( size_t xWantedSize )
                 }
 
                 xFreeBytesRemaining -= pxBlock->xBlockSize;
+                if( xFreeBytesRemaining < xMinimumEverFreeBytesRemaining )
+                {
+                    xMinimumEverFreeBytesRemaining = xFreeBytesRemaining;
+                }
+                xNumberOfSuccessfulAllocations++;
+                heapHISTOGRAM_ADD( pxBlock->xBlockSize, 1 );
             }
         }
+
+        if( pvReturn == NULL )
+        {
+            xNumberOfFailedAllocations++;
+        }
     }
     xTaskResumeAll();
 
@@ -276,18 +323,17 @@ void *pvPortMalloc( size_t xWantedSize )
 #define END_OF_HEAP        ((xBlockLink*) (((char*)&xHeap) + configTOTAL_HEAP_SIZE))
 #define END_OF_BLOCK(blk)  ((xBlockLink*) (((char*)blk) + blk->xBlockSize))
 
+/* Blocks of the same size can come in any order, so the size list is
+   searched for the victim itself */
 #define prvRemoveFromFreeList(victim, previousByAddr)                   \
     {                                                                   \
-        xBlockLink *previousBySize, *successorBySize;                   \
+        xBlockLink *previousBySize;                                     \
         previousByAddr->pxNextAddrBlock = victim->pxNextAddrBlock;      \
         previousBySize = &xStartSize;                                   \
-        while (previousBySize->pxNextSizeBlock != NULL) {               \
-            successorBySize = previousBySize->pxNextSizeBlock;          \
-            if (successorBySize->xBlockSize >= victim->xBlockSize)      \
-                break;                                                  \
-            previousBySize = successorBySize;                           \
-        }                                                               \
+        while (previousBySize->pxNextSizeBlock != victim)               \
+            previousBySize = previousBySize->pxNextSizeBlock;           \
         previousBySize->pxNextSizeBlock = victim->pxNextSizeBlock;      \
+        xNumberOfFreeBlocks--;                                          \
     }
 
 void vPortFree( void *pv )
@@ -308,11 +354,18 @@ void vPortFree( void *pv )
         {
             xBlockLink *previousPrevious, *previous, *successor;
 
+            xNumberOfSuccessfulFrees++;
+            heapHISTOGRAM_ADD( pxLink->xBlockSize, -1 );
+            /* Before merging, which makes pxLink cover its neighbours */
+            xFreeBytesRemaining += pxLink->xBlockSize;
+
             previousPrevious = NULL;
             previous = &xStartAddr;
+            /* Nothing to merge with when every block was in use */
+            successor = &xEnd;
             while (previous->pxNextAddrBlock != &xEnd) {
                 successor = previous->pxNextAddrBlock;
-                if ((unsigned int) successor >= (unsigned int) pxLink)
+                if ((uintptr_t) successor >= (uintptr_t) pxLink)
                     break;
                 previousPrevious = previous;
                 previous = successor;
@@ -332,7 +385,6 @@ void vPortFree( void *pv )
             }
 
             prvInsertBlockIntoFreeList( ( ( xBlockLink * ) pxLink ) );
-            xFreeBytesRemaining += pxLink->xBlockSize;
         }
         xTaskResumeAll();
     }
@@ -345,6 +397,60 @@ size_t xPortGetFreeHeapSize( void )
 }
 /*-----------------------------------------------------------*/
 
+/* The size list is walked to its last block, so this takes time in
+   proportion to the number of free blocks. */
+void vPortGetHeapStats( xHeapStats *pxHeapStats )
+{
+    xBlockLink *pxBlock;
+    size_t xLargest = 0;
+
+    vTaskSuspendAll();
+    {
+        if( xStartSize.pxNextSizeBlock != NULL )
+        {
+            for( pxBlock = xStartSize.pxNextSizeBlock; pxBlock != &xEnd; pxBlock = pxBlock->pxNextSizeBlock )
+            {
+                xLargest = pxBlock->xBlockSize;
+            }
+        }
+
+        pxHeapStats->xAvailableHeapSpaceInBytes = xFreeBytesRemaining;
+        pxHeapStats->xSizeOfLargestFreeBlockInBytes = xLargest;
+        pxHeapStats->xNumberOfFreeBlocks = xNumberOfFreeBlocks;
+        pxHeapStats->xMinimumEverFreeBytesRemaining = xMinimumEverFreeBytesRemaining;
+        pxHeapStats->xNumberOfSuccessfulAllocations = xNumberOfSuccessfulAllocations;
+        pxHeapStats->xNumberOfSuccessfulFrees = xNumberOfSuccessfulFrees;
+        pxHeapStats->xNumberOfFailedAllocations = xNumberOfFailedAllocations;
+    }
+    xTaskResumeAll();
+}
+/*-----------------------------------------------------------*/
+
+void vPortGetHeapHistogram( xHeapHistogram *pxHistogram )
+{
+    memset( pxHistogram, 0, sizeof( *pxHistogram ) );
+
+#if( configHEAP_HISTOGRAM == 1 )
+    {
+        xBlockLink *pxBlock;
+
+        vTaskSuspendAll();
+        {
+            memcpy( pxHistogram->ulUsedBlocks, ulUsedBlocks, sizeof( ulUsedBlocks ) );
+            if( xStartAddr.pxNextAddrBlock != NULL )
+            {
+                for( pxBlock = xStartAddr.pxNextAddrBlock; pxBlock != &xEnd; pxBlock = pxBlock->pxNextAddrBlock )
+                {
+                    pxHistogram->ulFreeBlocks[ prvHistogramClass( pxBlock->xBlockSize ) ]++;
+                }
+            }
+        }
+        xTaskResumeAll();
+    }
+#endif
+}
+/*-----------------------------------------------------------*/
+
 void vPortInitialiseBlocks( void )
 {
     /* This just exists to keep the linker quiet. */
@@ -80,6 +80,7 @@
 #define configMAX_PRIORITIES		( ( unsigned portBASE_TYPE ) 5 )
 #define configMINIMAL_STACK_SIZE	( ( unsigned short ) 128 )
 #define configTOTAL_HEAP_SIZE		( ( size_t ) ( 17 * 1024 ) )
+#define configHEAP_HISTOGRAM		1	/* See heap_stats.h */
 #define configMAX_TASK_NAME_LEN		( 16 )
 #define configUSE_TRACE_FACILITY	1
 #define configUSE_16_BIT_TICKS		0
@@ -113,5 +114,16 @@ configKERNEL_INTERRUPT_PRIORITY setting.  Here 15 corresponds to the lowest
 NVIC value of 255. */
 #define configLIBRARY_KERNEL_INTERRUPT_PRIORITY	15
 
+/* Kernel event trace into a RAM ring, see trace.h */
+#include "trace.h"
+
+#define traceTASK_CREATE(pxNewTCB)           trace_task_create(pxNewTCB, pxNewTCB->pcTaskName)
+#define traceTASK_SWITCHED_OUT()             trace_switched_out(pxCurrentTCB)
+#define traceTASK_SWITCHED_IN()              trace_switched_in(pxCurrentTCB)
+#define traceQUEUE_SEND(pxQueue)             trace_event(TRACE_QUEUE_SEND, pxQueue)
+#define traceQUEUE_SEND_FROM_ISR(pxQueue)    trace_event(TRACE_QUEUE_SEND, pxQueue)
+#define traceQUEUE_RECEIVE(pxQueue)          trace_event(TRACE_QUEUE_RECEIVE, pxQueue)
+#define traceQUEUE_RECEIVE_FROM_ISR(pxQueue) trace_event(TRACE_QUEUE_RECEIVE, pxQueue)
+
 #endif /* FREERTOS_CONFIG_H */
 
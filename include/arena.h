@@ -0,0 +1,37 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Region allocator for short lived work. Allocation moves a pointer
+ * through a buffer the owner provides, nothing is freed on its own and
+ * arena_reset() drops everything at once. When the buffer runs out the
+ * arena grows by chunks from the heap, which arena_reset() gives back, so
+ * the heap is only touched when the buffer was sized too small. */
+
+/* Smallest chunk taken from the heap when the buffer is full */
+#ifndef ARENA_CHUNK_SIZE
+#define ARENA_CHUNK_SIZE 256
+#endif
+
+typedef struct arena_chunk_t arena_chunk_t;
+
+typedef struct arena_t{
+    uint8_t* base;
+    size_t size;
+    size_t used;
+    arena_chunk_t* chunks;  /* Heap chunks, newest first */
+    size_t allocated;       /* Bytes handed out since the last reset */
+    size_t peak;            /* Most bytes handed out between two resets */
+    uint32_t overflows;     /* Heap chunks taken since arena_init */
+}arena_t;
+
+void arena_init(arena_t* arena, void* buf, size_t size);
+/* 8 byte aligned, NULL when the heap is exhausted too */
+void* arena_alloc(arena_t* arena, size_t size);
+void* arena_calloc(arena_t* arena, size_t size);
+char* arena_strdup(arena_t* arena, const char* str);
+void arena_reset(arena_t* arena);
+
+#endif
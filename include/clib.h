@@ -7,10 +7,21 @@
  */
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
 
-/* fprintf for fio */
+/* fio_printf formats on the caller's stack and writes out a buffer of this
+ * size at a time */
+#ifndef FIO_PRINTF_BUFFER
+#define FIO_PRINTF_BUFFER 128
+#endif
+
+/* fprintf for fio, see vformat() in clib.c for the supported conversions */
 size_t fio_printf(int fd, const char *format, ...);
-int sprnitf(char *, const char *, ...);
+size_t vfio_printf(int fd, const char *format, va_list ap);
+int sprintf(char *, const char *, ...);
+int snprintf(char *, size_t, const char *, ...);
+int vsnprintf(char *, size_t, const char *, va_list);
 
 /* I would like to rename itoa as to_string (idea from C++11) 
  * however c doesn't allow function overloading */
@@ -14,6 +14,7 @@
 
 ssize_t stdin_read(struct inode_t* node, void* buf, size_t count, off_t offset);
 ssize_t stdout_write(struct inode_t* node, const void* buf, size_t count, off_t offset);
+ssize_t stdout_writev(struct inode_t* node, const fio_iovec_t* iov, int iovcnt, off_t offset);
 
 void register_devfs();
 
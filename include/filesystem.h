@@ -5,11 +5,13 @@
 #include <hash-djb2.h>
 #include <FreeRTOS.h>
 #include <semphr.h>
+#include "rwlock.h"
 
 #define MAX_FS 16
 #define OPENFAIL (-1)
 
 struct dir_entity;
+struct fio_iovec_t;
 
 typedef struct inode_t{
     uint32_t device;
@@ -22,12 +24,23 @@ typedef struct inode_t{
         int (*i_mkdir)(struct inode_t* node, const char* path);
     }inode_ops;
     uint32_t count;
-    xSemaphoreHandle lock;
+    /* Shared for reads, exclusive for anything that changes the file */
+    rwlock_t* lock;
     struct file_operations{
         off_t (*lseek)(struct inode_t* node, off_t offset);
         ssize_t (*read)(struct inode_t* node, void* buf, size_t count, off_t offset);
         ssize_t (*write)(struct inode_t* node, const void* buf, size_t count, off_t offset);
         ssize_t (*readdir)(struct inode_t* node, struct dir_entity* filldir, off_t offset);
+        int (*truncate)(struct inode_t* node, off_t length);
+        /* Point *ptr at the data at offset, return how many bytes of it are
+         * contiguous (at most count), 0 at end of file */
+        ssize_t (*map)(struct inode_t* node, const void** ptr, size_t count, off_t offset);
+        /* Optional, fio loops over read/write when these are missing */
+        ssize_t (*readv)(struct inode_t* node, const struct fio_iovec_t* iov, int iovcnt, off_t offset);
+        ssize_t (*writev)(struct inode_t* node, const struct fio_iovec_t* iov, int iovcnt, off_t offset);
+        /* Optional, write back whatever the filesystem caches itself. Called
+         * by fio_flush and fio_close. */
+        int (*flush)(struct inode_t* node);
     }file_ops;
     void* opaque;
 }inode_t;
@@ -53,6 +66,22 @@ typedef struct fs_type_t {
     struct fs_type_t* next;
 }fs_type_t;
 
+typedef struct fs_dcache_stat_t{
+    uint32_t size;
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t replaces;
+    uint32_t invalidations;
+}fs_dcache_stat_t;
+
+typedef struct fs_icache_stat_t{
+    uint32_t size;
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t failures;
+}fs_icache_stat_t;
+
 /*
 typedef int (*fs_open_t)(void * opaque, const char * fname, int flags, int mode);
 typedef int (*fs_opendir_t)(void * opaque, char* path);
@@ -65,8 +94,13 @@ int fs_mount(inode_t* mountpoint, uint32_t type, void* opaque);
 int fs_open(const char* path, inode_t** inode);
 inode_t* fs_open_inode(uint32_t device, uint32_t number);
 void fs_close_inode(inode_t* inode);
+void fs_icache_stat(fs_icache_stat_t* stat);
 
 int fs_mkdir(const char * path);
+
+/* Drop cached lookups below parent, or every entry if parent is NULL */
+void fs_dcache_invalidate(inode_t* parent);
+void fs_dcache_stat(fs_dcache_stat_t* stat);
 /*
 int fs_opendir(char * path);
 int fs_list(const char * path, char*** ret_path);
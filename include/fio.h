@@ -17,19 +17,94 @@ enum open_types_t {
 #define MAX_FDS 32
 #define MAX_DDS 4
 
+/* Buffer size fio allocates when none is given to fio_setvbuf */
+#ifndef FIO_BUFSIZ
+#define FIO_BUFSIZ 128
+#endif
+
+/* Buffering modes, files opened on devfs default to line buffered, files
+ * that can be mapped (romfs, ramfs) to unbuffered and everything else to
+ * fully buffered */
+enum fio_buf_modes_t {
+    FIO_IONBF = 0,
+    FIO_IOLBF = 1,
+    FIO_IOFBF = 2,
+};
+
 typedef struct dir_entity {
     uint8_t d_attr;
     char d_name[256];    
 }dir_entity_t;
 
+typedef struct fio_iovec_t {
+    void * base;
+    size_t len;
+}fio_iovec_t;
+
 struct fddef_t {
     inode_t* inode;
     uint32_t flags;
     uint32_t mode;
     size_t cursor;
     void * opaque;
+    void * bounce;
+    size_t bounce_size;
+    /* buf holds buf_len bytes of the file starting at buf_base, pending
+     * writes when buf_dirty is set, read ahead otherwise */
+    int buf_mode;
+    int buf_owned;
+    int buf_dirty;
+    uint8_t * buf;
+    size_t buf_size;
+    size_t buf_len;
+    size_t buf_base;
+};
+
+/* Asynchronous request, see fio_submit. offset < 0 reads or writes at the
+ * cursor like fio_read/fio_write, otherwise like fio_pread/fio_pwrite. */
+enum fio_aio_ops_t {
+    FIO_AIO_READ = 0,
+    FIO_AIO_WRITE = 1,
+};
+
+enum fio_aio_states_t {
+    FIO_AIO_IDLE = 0,
+    FIO_AIO_QUEUED = 1,
+    FIO_AIO_DONE = 2,
 };
 
+typedef struct fio_aio_t {
+    int fd;
+    int op;
+    void * buf;
+    size_t count;
+    off_t offset;
+    /* Optional, called from the I/O task once result is set and before
+     * the request is done, it must not free or resubmit req */
+    void (*done)(struct fio_aio_t * req);
+    void * opaque;
+    /* Owned by fio while the request is queued */
+    volatile ssize_t result;
+    volatile int state;
+    xSemaphoreHandle sem;
+    struct fio_aio_t * next;
+}fio_aio_t;
+
+/* I/O task priority above idle, and its stack depth in words */
+#ifndef FIO_AIO_PRIORITY
+#define FIO_AIO_PRIORITY 1
+#endif
+#ifndef FIO_AIO_STACK_SIZE
+#define FIO_AIO_STACK_SIZE 256
+#endif
+/* Semaphores kept for tasks blocked in fio_wait at the same time, more
+ * waiters create their own */
+#ifndef FIO_AIO_WAITERS
+#define FIO_AIO_WAITERS 4
+#endif
+/* Most consecutive writes on one fd merged into a single fio_writev */
+#define FIO_AIO_BATCH 8
+
 struct dddef_t {
     inode_t* inode;
     size_t cursor;
@@ -46,11 +121,43 @@ int fio_closedir(int dd);
 off_t fio_seekdir(int fd, off_t offset);
 ssize_t fio_readdir(int dd, struct dir_entity* ent);
 
+struct fddef_t * fio_getfd(int fd);
 int fio_is_open(int fd);
 int fio_open(const char * path, int flags, int mode);
 ssize_t fio_read(int fd, void * buf, size_t count);
 ssize_t fio_write(int fd, const void * buf, size_t count);
+/* Positional I/O, the cursor is neither used nor moved. Reads only share
+ * the inode lock, so readers of one file run in parallel. */
+ssize_t fio_pread(int fd, void * buf, size_t count, off_t offset);
+ssize_t fio_pwrite(int fd, const void * buf, size_t count, off_t offset);
+/* Scatter/gather, all segments are transferred under one inode lock */
+ssize_t fio_readv(int fd, const fio_iovec_t * iov, int iovcnt);
+ssize_t fio_writev(int fd, const fio_iovec_t * iov, int iovcnt);
 off_t fio_seek(int fd, off_t offset, int whence);
 int fio_close(int fd);
+/* Like setvbuf, buf may be NULL to have fio allocate size bytes on first
+ * use. Pending output is flushed first. */
+int fio_setvbuf(int fd, void * buf, int mode, size_t size);
+int fio_flush(int fd);
 void fio_set_opaque(int fd, void * opaque);
+
+/* Map len bytes at offset without moving the cursor. Returns the number of
+ * bytes mapped (less than len only at end of file), 0 at end of file.
+ * Read-only filesystems such as romfs hand out pointers into their own
+ * storage, other spans are copied into a per fd bounce buffer that the next
+ * fio_map on the same fd overwrites. The buffer lives until fio_close. */
+ssize_t fio_map(int fd, off_t offset, size_t len, const void ** ptr);
+int fio_unmap(int fd, const void * ptr);
+
+/* Starts the I/O task that serves fio_submit */
+void fio_aio_init();
+/* Queue a request and return at once. The request and its buffer belong
+ * to fio until it is done, that is fio_aio_done is true or fio_wait
+ * returns 0. done() is called before that, while fio still owns req.
+ * Requests on the same inode run in submission order, files are served
+ * before character devices. */
+int fio_submit(fio_aio_t * req);
+/* 0 once req is done and req->result is valid, -1 on timeout */
+int fio_wait(fio_aio_t * req, portTickType ticks);
+int fio_aio_done(const fio_aio_t * req);
 #endif
@@ -3,6 +3,11 @@
 
 #include <unistd.h>
 
+#define HASH_DJB2_INIT 5381
+
 uint32_t hash_djb2(const uint8_t * str, ssize_t max);
+/* Extend a hash with more characters, hashing a path piecewise gives the
+ * same result as hashing it at once */
+uint32_t hash_djb2_continue(uint32_t hash, const uint8_t * str, ssize_t max);
 
 #endif
@@ -0,0 +1,36 @@
+#ifndef __HEAP_STATS_H__
+#define __HEAP_STATS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Statistics of the heap_XX.c selected by HEAP_IMPL. Block sizes include
+ * the allocator's header, as xPortGetFreeHeapSize() does. */
+
+typedef struct xHEAP_STATS
+{
+    size_t xAvailableHeapSpaceInBytes;
+    size_t xSizeOfLargestFreeBlockInBytes;
+    size_t xNumberOfFreeBlocks;
+    size_t xMinimumEverFreeBytesRemaining;
+    size_t xNumberOfSuccessfulAllocations;
+    size_t xNumberOfSuccessfulFrees;
+    size_t xNumberOfFailedAllocations;
+} xHeapStats;
+
+void vPortGetHeapStats( xHeapStats *pxHeapStats );
+
+/* Class i counts blocks of 2^i up to 2^(i+1)-1 bytes, the last class
+ * everything larger. Set configHEAP_HISTOGRAM to 1 in FreeRTOSConfig.h to
+ * keep it, it costs a counter update on every malloc and free. */
+#define heapHISTOGRAM_CLASSES 16
+
+typedef struct xHEAP_HISTOGRAM
+{
+    uint32_t ulFreeBlocks[ heapHISTOGRAM_CLASSES ];
+    uint32_t ulUsedBlocks[ heapHISTOGRAM_CLASSES ];
+} xHeapHistogram;
+
+void vPortGetHeapHistogram( xHeapHistogram *pxHistogram );
+
+#endif
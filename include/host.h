@@ -38,6 +38,9 @@ int host_system(va_list v1);
 int host_open(va_list v1);
 int host_close(va_list v1);
 int host_write(va_list v1);
+int host_read(va_list v1);
+int host_seek(va_list v1);
+int host_flen(va_list v1);
 
 int host_action(enum HOST_SYSCALL action, ...);
 
@@ -0,0 +1,37 @@
+#ifndef __HOSTFS_H__
+#define __HOSTFS_H__
+
+#include <stdint.h>
+#include <filesystem.h>
+
+#define HOSTFS_TYPE 1569918576
+
+#define MAX_HOSTFS_MOUNTS 2
+
+/* Host files known to one mount, the root directory included */
+#ifndef HOSTFS_MAX_NODES
+#define HOSTFS_MAX_NODES 16
+#endif
+#define HOSTFS_PATH_MAX 64
+
+/* Every semihosting call traps into the debugger, so small transfers go
+ * through a per mount cache of HOSTFS_CACHE_BLOCKS blocks. Transfers of a
+ * block or more go to the host directly in a single call. The block size
+ * has to be a power of 2. */
+#ifndef HOSTFS_BLOCK_SIZE
+#define HOSTFS_BLOCK_SIZE 512
+#endif
+#ifndef HOSTFS_CACHE_BLOCKS
+#define HOSTFS_CACHE_BLOCKS 2
+#endif
+
+/* Mount /host at boot. Semihosting HardFaults without a debugger or QEMU
+ * -semihosting attached, so it is off unless the build asks for it. */
+#ifndef HOSTFS_MOUNT_AT_BOOT
+#define HOSTFS_MOUNT_AT_BOOT 0
+#endif
+
+/* fs_mount opaque is the host directory to expose, e.g. "." */
+void register_hostfs();
+
+#endif
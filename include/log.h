@@ -0,0 +1,57 @@
+#ifndef __LOG_H__
+#define __LOG_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+
+/* Producers copy records into a lock-free RAM ring and return, a low
+ * priority task moves them to the sink in large writes. When the ring is
+ * full the record is dropped and counted, producers never wait. */
+
+/* Power of 2 */
+#ifndef LOG_RING_SIZE
+#define LOG_RING_SIZE 1024
+#endif
+/* Largest single record, longer ones are cut */
+#define LOG_RECORD_MAX 128
+/* Bytes the flusher gathers before it writes to the sink */
+#ifndef LOG_BATCH_SIZE
+#define LOG_BATCH_SIZE 256
+#endif
+/* The flusher wakes this often, or as soon as the ring is half full */
+#ifndef LOG_FLUSH_PERIOD
+#define LOG_FLUSH_PERIOD 500
+#endif
+#ifndef LOG_PRIORITY
+#define LOG_PRIORITY 1
+#endif
+#ifndef LOG_STACK_SIZE
+#define LOG_STACK_SIZE 256
+#endif
+
+typedef struct log_stat_t{
+    uint32_t records;
+    uint32_t bytes;
+    uint32_t dropped;
+    uint32_t flushed;       /* Bytes handed to the sink */
+    uint32_t sink_errors;
+    uint32_t high_water;    /* Most bytes ever queued in the ring */
+}log_stat_t;
+
+/* Starts the flusher. Records are kept in the ring until a sink is set. */
+void log_init();
+/* Any fio fd, e.g. 1 for the UART or a file on /host or ramfs. -1 stops
+ * flushing. Returns the previous sink. */
+int log_set_sink(int fd);
+
+/* Both return the number of bytes queued, -1 if the record was dropped */
+int log_write(const void* buf, size_t count);
+int log_printf(const char* fmt, ...);
+int vlog_printf(const char* fmt, va_list ap);
+
+/* Push everything queued so far to the sink before returning */
+int log_flush();
+void log_stat(log_stat_t* stat);
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include <stdint.h>
+
+/* Fixed size object pools with the capacity set at compile time. Objects
+ * live in a static array, free ones are kept on a stack of indices, so get
+ * and put take constant time and no object carries a heap header.
+ *
+ * An object keeps its contents while it sits in the pool and a fresh one
+ * is all zero. A pool can therefore hand out objects that are already set
+ * up, e.g. with their semaphore still created, see rwlock.c. */
+typedef struct pool_t{
+    const char* name;
+    uint8_t* objects;
+    uint16_t* free_stack;
+    uint16_t object_size;
+    uint16_t capacity;
+    uint16_t next_unused;   /* Objects from here on were never handed out */
+    uint16_t free_count;
+    uint16_t used;
+    uint16_t high_water;
+    uint32_t failures;      /* Gets while the pool was empty */
+    struct pool_t* next;    /* Pools in use, for pool_stat() */
+    uint8_t registered;
+}pool_t;
+
+typedef struct pool_stat_t{
+    const char* name;
+    uint32_t object_size;
+    uint32_t capacity;
+    uint32_t used;
+    uint32_t high_water;
+    uint32_t failures;
+}pool_stat_t;
+
+/* Defines a pool and the typed name_get() and name_put() for it */
+#define POOL_DEFINE(pname, type, count)                                    \
+    static type pname##_objects[count];                                     \
+    static uint16_t pname##_free[count];                                    \
+    static pool_t pname = {                                                 \
+        .name = #pname,                                                     \
+        .objects = (uint8_t*)pname##_objects,                               \
+        .free_stack = pname##_free,                                         \
+        .object_size = sizeof(type),                                        \
+        .capacity = (count),                                                \
+    };                                                                      \
+    static inline type* pname##_get(void){                                  \
+        return (type*)pool_get(&pname);                                     \
+    }                                                                       \
+    static inline void pname##_put(type* object){                           \
+        pool_put(&pname, object);                                           \
+    }
+
+/* NULL when every object is in use */
+void* pool_get(pool_t* pool);
+void pool_put(pool_t* pool, void* object);
+
+/* Pools that handed out at least one object, index from 0. Returns -1 past
+ * the last one. */
+int pool_stat(int index, pool_stat_t* stat);
+
+#endif
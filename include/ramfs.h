@@ -6,8 +6,41 @@
 
 #define RAMFS_TYPE 194671278
 
-#define MAX_INODE_BLOCK_COUNT 32
-#define BLOCK_SIZE 64
+/* Block size used when fs_mount is not given a ramfs_mount_opt_t, it has
+ * to be a power of 2 */
+#ifndef RAMFS_DEFAULT_BLOCK_SIZE
+#define RAMFS_DEFAULT_BLOCK_SIZE 128
+#endif
+#define RAMFS_MIN_BLOCK_SIZE 16
+
+/* Number of entries of a fresh indirect block table */
+#define RAMFS_INITIAL_BLOCK_TABLE 4
+/* Number of slots of a fresh directory index, must be a power of 2 */
+#define RAMFS_INITIAL_DIR_INDEX 8
+
+/* Bytes per slab chunk for ramfs inodes and blocks */
+#ifndef RAMFS_SLAB_CHUNK_SIZE
+#define RAMFS_SLAB_CHUNK_SIZE 512
+#endif
+#define RAMFS_SLAB_NONE 0xFFFFFFFF
+
+/* Superblocks come from a pool of this many */
+#ifndef MAX_RAMFS_MOUNTS
+#define MAX_RAMFS_MOUNTS 4
+#endif
+
+struct ramfs_superblock_t;
+
+typedef struct ramfs_slab_t{
+    uint32_t object_size;
+    uint32_t chunk_shift;       /* 1 << chunk_shift objects per chunk */
+    uint32_t chunk_count;
+    uint32_t chunk_capacity;
+    uint8_t** chunks;
+    uint32_t next_unused;       /* Objects below this index were handed out once */
+    uint32_t free_head;
+    uint32_t used;
+}ramfs_slab_t;
 
 typedef struct ramfs_inode_t{
     uint32_t hash;
@@ -17,22 +50,26 @@ typedef struct ramfs_inode_t{
     char filename[64];
     uint32_t data_length;
     uint32_t block_count;
-    uint32_t blocks[MAX_INODE_BLOCK_COUNT];
+    uint32_t block_capacity;
+    uint32_t* blocks;   /* Block numbers, or child inode numbers for a directory */
+    uint32_t index_size;
+    uint32_t* index;    /* Directory only, name hash -> position in blocks */
+    struct ramfs_superblock_t* sb;
 }ramfs_inode_t;
 
-typedef struct ramfs_block_t {
-    uint8_t data[BLOCK_SIZE];
-}ramfs_block_t;
-
 typedef struct ramfs_superblock_t{
     uint32_t device;
-    uint32_t inode_count;
-    uint32_t block_count;
-    ramfs_inode_t** inode_list;
-    ramfs_block_t** block_pool;
+    uint32_t block_size;
+    uint32_t block_shift;
+    ramfs_slab_t inodes;
+    ramfs_slab_t blocks;
     struct ramfs_superblock_t* next;
 }ramfs_superblock_t;
 
+typedef struct ramfs_mount_opt_t{
+    uint32_t block_size;
+}ramfs_mount_opt_t;
+
 void register_ramfs();
 
 #endif
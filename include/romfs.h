@@ -0,0 +1,14 @@
+#ifndef __ROMFS_H__
+#define __ROMFS_H__
+
+#include <stdint.h>
+#include <filesystem.h>
+
+#define ROMFS_TYPE 194595040
+
+#define MAX_ROMFS_MOUNTS 2
+
+void register_romfs();
+int32_t romfs_get_file_by_hash(const uint8_t * romfs, uint32_t h, uint32_t * len);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef __RWLOCK_H__
+#define __RWLOCK_H__
+
+#include <stdint.h>
+#include <FreeRTOS.h>
+#include <semphr.h>
+
+/* Readers share the lock, writers get it alone. A waiting writer stops new
+ * readers from joining, so a steady stream of readers can not starve it.
+ *
+ * Only one binary semaphore per lock: it is held by a writer or by the
+ * current group of readers, the first reader takes it and the last one
+ * gives it back. The counters are only touched inside critical sections.
+ */
+typedef struct rwlock_t{
+    xSemaphoreHandle lock;
+    volatile uint32_t readers;
+    volatile uint32_t writers_waiting;
+}rwlock_t;
+
+/* Locks come from a pool, one per inode cache slot and the stdio inodes */
+#ifndef RWLOCK_POOL_SIZE
+#define RWLOCK_POOL_SIZE 40
+#endif
+
+/* Returns NULL when the pool or the heap is exhausted */
+rwlock_t* rwlock_create(void);
+void rwlock_delete(rwlock_t* rw);
+
+void rwlock_read_lock(rwlock_t* rw);
+void rwlock_read_unlock(rwlock_t* rw);
+void rwlock_write_lock(rwlock_t* rw);
+void rwlock_write_unlock(rwlock_t* rw);
+
+#endif
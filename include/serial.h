@@ -0,0 +1,52 @@
+#ifndef __SERIAL_H__
+#define __SERIAL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Must be a power of 2 */
+#ifndef SERIAL_TX_BUFFER_SIZE
+#define SERIAL_TX_BUFFER_SIZE 256
+#endif
+
+/* Bytes the receive interrupt can hold until the line discipline runs */
+#ifndef SERIAL_RX_BUFFER_SIZE
+#define SERIAL_RX_BUFFER_SIZE 128
+#endif
+
+/* Input waiting for a reader, completed lines or raw bytes */
+#ifndef SERIAL_INPUT_BUFFER_SIZE
+#define SERIAL_INPUT_BUFFER_SIZE 256
+#endif
+
+/* Longest line including its terminator, longer input is dropped. A
+ * read of this many bytes always returns a terminated line. */
+#ifndef SERIAL_LINE_MAX
+#define SERIAL_LINE_MAX 127
+#endif
+
+/* Sets up DMA1 Channel7 to drain the TX ring into USART2 and starts the
+ * line discipline task. Call after init_rs232(), before anything is
+ * written. */
+void serial_init(void);
+
+/* Queues count bytes for transmission and returns once they are all in the
+ * ring, only blocking while the ring is full. Not callable from an ISR. */
+size_t serial_write(const void* buf, size_t count);
+
+/* All segments are queued back to back, another writer can not slip in
+ * between them */
+struct fio_iovec_t;
+size_t serial_writev(const struct fio_iovec_t* iov, int iovcnt);
+
+/* Cooked mode (the default) echoes input, handles backspace, drops escape
+ * sequences and returns one line per call with the line end replaced by
+ * '\0'. Raw mode returns whatever bytes have arrived, untouched and
+ * without echo. */
+size_t serial_read(void* buf, size_t count);
+void serial_set_raw(int raw);
+
+/* Bytes lost because the receive ring was full or the UART overran */
+uint32_t serial_rx_dropped(void);
+
+#endif
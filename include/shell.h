@@ -1,6 +1,16 @@
 #ifndef SHELL_H
 #define SHELL_H
 
+#include "arena.h"
+
+/* Static part of the per command arena, see command_prompt() */
+#ifndef SHELL_ARENA_SIZE
+#define SHELL_ARENA_SIZE 1536
+#endif
+
+/* Scratch memory of the running command, reset when the command returns */
+extern arena_t *cmd_arena;
+
 int parse_command(char *str, char *argv[]);
 
 typedef void cmdfunc(int, char *[]);
@@ -0,0 +1,62 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+
+/* Kernel events are stamped with the tick count plus the SysTick cycles
+ * into the tick and stored as fixed size binary records in a RAM ring. The
+ * ring keeps the newest TRACE_RING_SIZE records, older ones are overwritten.
+ * Formatting only happens when the ring is dumped. */
+
+/* Records, power of 2 */
+#ifndef TRACE_RING_SIZE
+#define TRACE_RING_SIZE 512
+#endif
+/* Tasks whose names are remembered for the %create lines */
+#ifndef TRACE_MAX_TASKS
+#define TRACE_MAX_TASKS 16
+#endif
+#define TRACE_NAME_MAX 16
+
+#define TRACE_DUMP_FILE "/host/output/trace.log"
+
+enum {
+    TRACE_TASK_IN = 1,
+    TRACE_TASK_OUT,
+    TRACE_QUEUE_SEND,
+    TRACE_QUEUE_RECEIVE,
+    TRACE_ISR_ENTER,
+};
+
+typedef struct trace_rec_t{
+    uint32_t tick;
+    uint32_t stamp;     /* Cycles into the tick << 8 | event */
+    uint32_t obj;       /* Task, queue or IRQ number */
+}trace_rec_t;
+
+typedef struct trace_stat_t{
+    uint32_t events;    /* Recorded since the last clear */
+    uint32_t lost;      /* Overwritten before they were dumped */
+    int enabled;
+}trace_stat_t;
+
+/* Called by the kernel through the trace macros in FreeRTOSConfig.h */
+void trace_task_create(void* task, const signed char* name);
+void trace_switched_out(void* task);
+void trace_switched_in(void* task);
+void trace_event(uint32_t event, void* obj);
+/* From vApplicationTickHook, once per tick */
+void trace_tick();
+/* First thing in an interrupt handler */
+void trace_isr_enter();
+
+void trace_enable(int on);
+void trace_clear();
+void trace_stat(trace_stat_t* stat);
+
+/* Write the ring as %create, %in and %out lines for freertos/gdb2vcd.pl.
+ * Queue and interrupt events are written as %send, %recv and %isr lines,
+ * which gdb2vcd.pl skips. Tracing is paused while the dump runs. */
+int trace_dump(int fd);
+
+#endif
@@ -0,0 +1,59 @@
+# Native builds against the FreeRTOS shim in tool/host, for measuring the
+# VFS and the heap without hardware or QEMU.
+HOST_CC ?= gcc
+HOSTDIR = $(TOOLDIR)/host
+HOST_OUTDIR = $(OUTDIR)/host
+HOST_CFLAGS = -std=gnu99 -O2 -g -Wall -Werror -Wno-stringop-truncation \
+	      -I$(HOSTDIR) -Iinclude
+HOST_LIBS = -lpthread
+
+HOST_FS_SRC = src/filesystem.c \
+	      src/fio.c \
+	      src/rwlock.c \
+	      src/pool.c \
+	      src/aio.c \
+	      src/log.c \
+	      src/ramfs.c \
+	      src/romfs.c \
+	      src/devfs.c \
+	      src/hash-djb2.c \
+	      src/osdebug.c \
+	      $(HOSTDIR)/freertos_shim.c \
+	      $(HOSTDIR)/heap_host.c
+HOST_FS_OBJ = $(addprefix $(HOST_OUTDIR)/,$(HOST_FS_SRC:.c=.o))
+
+$(HOST_OUTDIR)/%.o: %.c
+	@mkdir -p $(dir $@)
+	@echo "    HOSTCC  "$@
+	@$(HOST_CC) $(HOST_CFLAGS) -MMD -MF $@.d -o $@ -c $<
+
+$(HOST_OUTDIR)/fsbench: $(HOST_OUTDIR)/$(TOOLDIR)/fsbench.o $(HOST_FS_OBJ)
+	@echo "    HOSTLD  "$@
+	@$(HOST_CC) $(HOST_CFLAGS) -o $@ $^ $(HOST_LIBS)
+
+fsbench: $(HOST_OUTDIR)/fsbench
+	@$(HOST_OUTDIR)/fsbench $(FSBENCH_ARGS)
+
+.PHONY: fsbench
+
+# mmtest with the heap chosen by HEAP_IMPL, e.g.
+# make mmbench HEAP_IMPL=heap_ww MMBENCH_ARGS="torture 10000"
+HOST_MM_SRC = src/mmtest.c \
+	      $(FREERTOS_SRC)/portable/MemMang/$(HEAP_IMPL).c \
+	      $(HOSTDIR)/freertos_shim.c
+HOST_MM_OBJ = $(addprefix $(HOST_OUTDIR)/,$(HOST_MM_SRC:.c=.o))
+
+$(HOST_OUTDIR)/src/mmtest.o: HOST_CFLAGS += -DMMTEST_NATIVE
+# The heap end marker is only a header, gcc assumes a whole block
+$(HOST_OUTDIR)/$(FREERTOS_SRC)/portable/MemMang/%.o: HOST_CFLAGS += -Wno-array-bounds
+
+$(HOST_OUTDIR)/mmbench-$(HEAP_IMPL): $(HOST_MM_OBJ)
+	@echo "    HOSTLD  "$@
+	@$(HOST_CC) $(HOST_CFLAGS) -o $@ $^ $(HOST_LIBS)
+
+mmbench: $(HOST_OUTDIR)/mmbench-$(HEAP_IMPL)
+	@$(HOST_OUTDIR)/mmbench-$(HEAP_IMPL) $(MMBENCH_ARGS)
+
+.PHONY: mmbench
+
+-include $(HOST_FS_OBJ:.o=.o.d) $(HOST_MM_OBJ:.o=.o.d)
@@ -0,0 +1,244 @@
+#include <FreeRTOS.h>
+#include <semphr.h>
+#include <task.h>
+#include "fio.h"
+#include "filesystem.h"
+#include "osdebug.h"
+#include "pool.h"
+
+/* Requests are queued FIFO on a singly linked list. The I/O task takes the
+ * whole list each time it wakes and works through it as one batch, so a
+ * single binary semaphore is enough to signal pending work. */
+static fio_aio_t * aio_head = NULL;
+static fio_aio_t * aio_tail = NULL;
+static xSemaphoreHandle aio_work = NULL;
+
+POOL_DEFINE(aio_sem_pool, xSemaphoreHandle, FIO_AIO_WAITERS)
+
+static inode_t * aio_inode(const fio_aio_t * req) {
+    struct fddef_t * f = fio_getfd(req->fd);
+
+    return f ? f->inode : NULL;
+}
+
+/* Regroup a batch so requests on one inode run back to back, files before
+ * character devices so that a slow UART does not hold up ramfs. Requests
+ * on the same inode keep their order. */
+static fio_aio_t * aio_schedule(fio_aio_t * list) {
+    fio_aio_t * out = NULL;
+    fio_aio_t ** out_tail = &out;
+    fio_aio_t ** p;
+    fio_aio_t ** q;
+    fio_aio_t * req;
+    inode_t * inode;
+    int pass;
+
+    for (pass = 0; pass < 2; pass++) {
+        p = &list;
+        while (*p) {
+            inode = aio_inode(*p);
+            if ((!inode || !inode->block_size) != pass) {
+                p = &(*p)->next;
+                continue;
+            }
+
+            q = p;
+            while (*q) {
+                if (aio_inode(*q) != inode) {
+                    q = &(*q)->next;
+                    continue;
+                }
+                req = *q;
+                *q = req->next;
+                req->next = NULL;
+                *out_tail = req;
+                out_tail = &req->next;
+            }
+        }
+    }
+
+    return out;
+}
+
+/* done() runs before the request is published, once state is DONE the
+ * owner may free or resubmit req and the I/O task must not touch it */
+static void aio_complete(fio_aio_t * req, ssize_t result) {
+    req->result = result;
+    if (req->done)
+        req->done(req);
+
+    taskENTER_CRITICAL();
+    req->state = FIO_AIO_DONE;
+    /* Given inside the critical section, fio_wait may delete it right after */
+    if (req->sem)
+        xSemaphoreGive(req->sem);
+    taskEXIT_CRITICAL();
+}
+
+/* Consecutive writes at the cursor of one fd go out as one fio_writev,
+ * the result is handed out to the requests in order */
+static fio_aio_t * aio_run_writes(fio_aio_t * req) {
+    fio_iovec_t iov[FIO_AIO_BATCH];
+    fio_aio_t * batch[FIO_AIO_BATCH];
+    fio_aio_t * next = req;
+    ssize_t total, r;
+    int fd = req->fd;
+    int i, n = 0;
+
+    while (next && (n < FIO_AIO_BATCH) && (next->fd == fd) &&
+           (next->op == FIO_AIO_WRITE) && (next->offset < 0)) {
+        iov[n].base = next->buf;
+        iov[n].len = next->count;
+        batch[n++] = next;
+        next = next->next;
+    }
+
+    if (n == 1)
+        total = fio_write(fd, req->buf, req->count);
+    else
+        total = fio_writev(fd, iov, n);
+
+    for (i = 0; i < n; i++) {
+        if (total < 0) {
+            r = total;
+        } else {
+            r = ((size_t) total < iov[i].len) ? total : (ssize_t) iov[i].len;
+            total -= r;
+        }
+        aio_complete(batch[i], r);
+    }
+
+    return next;
+}
+
+static fio_aio_t * aio_run(fio_aio_t * req) {
+    fio_aio_t * next = req->next;
+    ssize_t r;
+
+    if (req->op == FIO_AIO_WRITE) {
+        if (req->offset < 0)
+            return aio_run_writes(req);
+        r = fio_pwrite(req->fd, req->buf, req->count, req->offset);
+    } else if (req->offset < 0) {
+        r = fio_read(req->fd, req->buf, req->count);
+    } else {
+        r = fio_pread(req->fd, req->buf, req->count, req->offset);
+    }
+
+    aio_complete(req, r);
+    return next;
+}
+
+static void aio_task(void * arg) {
+    fio_aio_t * list;
+
+    while (1) {
+        xSemaphoreTake(aio_work, portMAX_DELAY);
+
+        taskENTER_CRITICAL();
+        list = aio_head;
+        aio_head = aio_tail = NULL;
+        taskEXIT_CRITICAL();
+
+        list = aio_schedule(list);
+        while (list)
+            list = aio_run(list);
+    }
+}
+
+void fio_aio_init() {
+    if (aio_work)
+        return;
+
+    vSemaphoreCreateBinary(aio_work);
+    if (!aio_work) {
+        DBGOUT("fio_aio_init: out of memory\r\n");
+        return;
+    }
+    xSemaphoreTake(aio_work, 0);
+
+    xTaskCreate(aio_task,
+                (signed portCHAR *) "aio",
+                FIO_AIO_STACK_SIZE, NULL, tskIDLE_PRIORITY + FIO_AIO_PRIORITY, NULL);
+}
+
+int fio_submit(fio_aio_t * req) {
+    if (!aio_work)
+        return -1;
+    if (!fio_is_open(req->fd))
+        return -2;
+    if ((req->op != FIO_AIO_READ) && (req->op != FIO_AIO_WRITE))
+        return -3;
+
+    taskENTER_CRITICAL();
+    if (req->state == FIO_AIO_QUEUED) {
+        taskEXIT_CRITICAL();
+        return -1;
+    }
+    req->state = FIO_AIO_QUEUED;
+    req->result = 0;
+    req->sem = NULL;
+    req->next = NULL;
+    if (aio_tail)
+        aio_tail->next = req;
+    else
+        aio_head = req;
+    aio_tail = req;
+    taskEXIT_CRITICAL();
+
+    xSemaphoreGive(aio_work);
+    return 0;
+}
+
+int fio_aio_done(const fio_aio_t * req) {
+    return req->state == FIO_AIO_DONE;
+}
+
+/* The semaphore is only needed when somebody actually waits, requests that
+ * are polled or have a callback never touch one. Waiters borrow one from
+ * aio_sem_pool, which keeps it for the next wait. */
+int fio_wait(fio_aio_t * req, portTickType ticks) {
+    xSemaphoreHandle * slot;
+    xSemaphoreHandle sem;
+    int done;
+
+    if (req->state == FIO_AIO_DONE)
+        return 0;
+    if ((req->state != FIO_AIO_QUEUED) || !ticks)
+        return -1;
+
+    slot = aio_sem_pool_get();
+    if (slot && *slot) {
+        sem = *slot;
+    } else {
+        vSemaphoreCreateBinary(sem);
+        if (!sem) {
+            aio_sem_pool_put(slot);
+            return -1;
+        }
+        if (slot)
+            *slot = sem;
+    }
+    /* Clears a give that came after an earlier wait timed out */
+    xSemaphoreTake(sem, 0);
+
+    taskENTER_CRITICAL();
+    done = (req->state == FIO_AIO_DONE);
+    if (!done)
+        req->sem = sem;
+    taskEXIT_CRITICAL();
+
+    if (!done) {
+        xSemaphoreTake(sem, ticks);
+        taskENTER_CRITICAL();
+        req->sem = NULL;
+        done = (req->state == FIO_AIO_DONE);
+        taskEXIT_CRITICAL();
+    }
+
+    if (slot)
+        aio_sem_pool_put(slot);
+    else
+        vQueueDelete(sem);
+    return done ? 0 : -1;
+}
@@ -0,0 +1,92 @@
+#include <string.h>
+#include "arena.h"
+#include "clib.h"
+
+#define ARENA_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+struct arena_chunk_t{
+    arena_chunk_t* next;
+    size_t size;
+    size_t used;
+};
+
+#define ARENA_CHUNK_HEADER ARENA_ALIGN(sizeof(arena_chunk_t))
+
+void arena_init(arena_t* arena, void* buf, size_t size){
+    /* The buffer may start anywhere, allocations still come out aligned */
+    size_t skip = ARENA_ALIGN((uintptr_t)buf) - (uintptr_t)buf;
+
+    arena->base = (uint8_t*)buf + skip;
+    arena->size = (size > skip) ? size - skip : 0;
+    arena->used = 0;
+    arena->chunks = NULL;
+    arena->allocated = 0;
+    arena->peak = 0;
+    arena->overflows = 0;
+}
+
+static void* arena_grow(arena_t* arena, size_t size){
+    arena_chunk_t* chunk = arena->chunks;
+    size_t chunk_size;
+
+    if(chunk && (chunk->size - chunk->used >= size)){
+        chunk->used += size;
+        return (uint8_t*)chunk + ARENA_CHUNK_HEADER + chunk->used - size;
+    }
+
+    chunk_size = (size > ARENA_CHUNK_SIZE) ? size : ARENA_CHUNK_SIZE;
+    chunk = (arena_chunk_t*)malloc(ARENA_CHUNK_HEADER + chunk_size);
+    if(!chunk)
+        return NULL;
+    chunk->size = chunk_size;
+    chunk->used = size;
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    arena->overflows++;
+    return (uint8_t*)chunk + ARENA_CHUNK_HEADER;
+}
+
+void* arena_alloc(arena_t* arena, size_t size){
+    void* ptr;
+
+    size = ARENA_ALIGN(size ? size : 1);
+    if(arena->size - arena->used >= size){
+        ptr = arena->base + arena->used;
+        arena->used += size;
+    }else if(!(ptr = arena_grow(arena, size))){
+        return NULL;
+    }
+
+    arena->allocated += size;
+    if(arena->allocated > arena->peak)
+        arena->peak = arena->allocated;
+    return ptr;
+}
+
+void* arena_calloc(arena_t* arena, size_t size){
+    void* ptr = arena_alloc(arena, size);
+
+    if(ptr)
+        memset(ptr, 0, size);
+    return ptr;
+}
+
+char* arena_strdup(arena_t* arena, const char* str){
+    size_t len = strlen(str) + 1;
+    char* ptr = (char*)arena_alloc(arena, len);
+
+    if(ptr)
+        memcpy(ptr, str, len);
+    return ptr;
+}
+
+void arena_reset(arena_t* arena){
+    arena_chunk_t* chunk;
+
+    while((chunk = arena->chunks)){
+        arena->chunks = chunk->next;
+        free(chunk);
+    }
+    arena->used = 0;
+    arena->allocated = 0;
+}
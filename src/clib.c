@@ -1,93 +1,308 @@
 #include <FreeRTOS.h>
 #include "fio.h"
 #include <stdarg.h>
+#include <string.h>
 #include "clib.h"
 
-void send_byte(char );
+/* Where formatted output goes. Characters collect in buf, a file sink
+ * writes buf out with one fio_write whenever it fills and once at the end,
+ * a string sink simply stops storing at size. count is what would have
+ * been produced without any limit. */
+typedef struct format_out_t{
+	char *buf;
+	size_t size;
+	size_t pos;
+	size_t count;
+	int fd;
+}format_out_t;
 
-size_t fio_printf(int fd, const char *format, ...){
-	int i,count=0;
-
-	va_list(v1);
-	va_start(v1, format);
-
-	int tmpint;
-	char *tmpcharp;
-	
-	for(i=0; format[i]; ++i){
-		if(format[i]=='%'){
-			switch(format[i+1]){
-				case '%':
-					send_byte('%'); break;
-				case 'd':
-				case 'x':
-				case 'X':
-					tmpint = va_arg(v1, int);
-					tmpcharp = itoa(format[i+1]=='x'?"0123456789abcdef":"0123456789ABCDEF", tmpint, format[i+1]=='d'?10: 16);
-					fio_write(fd, tmpcharp, strlen(tmpcharp));
-					break;
-				case 's':
-					tmpcharp = va_arg(v1, char *);
-					fio_write(fd, tmpcharp, strlen(tmpcharp));
-					break;
+enum format_flags_t{
+	FMT_LEFT = 1,
+	FMT_ZERO = 2,
+	FMT_PLUS = 4,
+	FMT_SPACE = 8,
+	FMT_ALT = 16,
+	FMT_UPPER = 32,
+};
+
+typedef struct format_spec_t{
+	int flags;
+	int width;
+	int precision;	/* -1 when not given */
+}format_spec_t;
+
+static void format_flush(format_out_t *out){
+	if(out->fd >= 0 && out->pos){
+		fio_write(out->fd, out->buf, out->pos);
+		out->pos = 0;
+	}
+}
+
+static void format_putc(format_out_t *out, char c){
+	if(out->pos == out->size)
+		format_flush(out);
+	if(out->pos < out->size)
+		out->buf[out->pos++] = c;
+	out->count++;
+}
+
+static void format_repeat(format_out_t *out, char c, int n){
+	for(; n > 0; --n)
+		format_putc(out, c);
+}
+
+static void format_string(format_out_t *out, const format_spec_t *spec, const char *str){
+	int len;
+
+	if(!str)
+		str = "(null)";
+	for(len = 0; str[len] && (spec->precision < 0 || len < spec->precision); ++len);
+
+	if(!(spec->flags & FMT_LEFT))
+		format_repeat(out, ' ', spec->width - len);
+	for(int i = 0; i < len; ++i)
+		format_putc(out, str[i]);
+	if(spec->flags & FMT_LEFT)
+		format_repeat(out, ' ', spec->width - len);
+}
+
+static void format_number(format_out_t *out, const format_spec_t *spec,
+		unsigned long long num, int negative, unsigned int base){
+	const char *digits = (spec->flags & FMT_UPPER) ? "0123456789ABCDEF" : "0123456789abcdef";
+	char buf[24];
+	char prefix[3];
+	int len = 0, prefix_len = 0, zeros, pad;
+
+	/* 64 bit division is a library call on the target, stay in 32 bits
+	 * whenever the value allows */
+	if(num <= 0xFFFFFFFFUL){
+		unsigned long n = (unsigned long)num;
+		for(; n; n /= base)
+			buf[len++] = digits[n % base];
+	}else{
+		for(; num; num /= base)
+			buf[len++] = digits[num % base];
+	}
+	/* %.0d of zero prints no digits at all */
+	if(!len && spec->precision != 0)
+		buf[len++] = '0';
+
+	if(negative)
+		prefix[prefix_len++] = '-';
+	else if(spec->flags & FMT_PLUS)
+		prefix[prefix_len++] = '+';
+	else if(spec->flags & FMT_SPACE)
+		prefix[prefix_len++] = ' ';
+
+	if((spec->flags & FMT_ALT) && len && buf[len - 1] != '0'){
+		if(base == 16){
+			prefix[prefix_len++] = '0';
+			prefix[prefix_len++] = (spec->flags & FMT_UPPER) ? 'X' : 'x';
+		}else if(base == 8){
+			buf[len++] = '0';
+		}
+	}
+
+	zeros = spec->precision > len ? spec->precision - len : 0;
+	pad = spec->width - prefix_len - zeros - len;
+	if((spec->flags & FMT_ZERO) && !(spec->flags & FMT_LEFT) && spec->precision < 0 && pad > 0){
+		zeros += pad;
+		pad = 0;
+	}
+
+	if(!(spec->flags & FMT_LEFT))
+		format_repeat(out, ' ', pad);
+	for(int i = 0; i < prefix_len; ++i)
+		format_putc(out, prefix[i]);
+	format_repeat(out, '0', zeros);
+	while(len)
+		format_putc(out, buf[--len]);
+	if(spec->flags & FMT_LEFT)
+		format_repeat(out, ' ', pad);
+}
+
+/* %[flags][width][.precision][length]conversion
+ * flags -0+ #, width and precision may be *, length hh h l ll z,
+ * conversions d i u o x X c s p % */
+static void vformat(format_out_t *out, const char *fmt, va_list ap){
+	format_spec_t spec;
+	unsigned long long num;
+	long long snum;
+	int length, negative;
+	unsigned int base;
+
+	for(; *fmt; ++fmt){
+		if(*fmt != '%'){
+			format_putc(out, *fmt);
+			continue;
+		}
+
+		spec.flags = 0;
+		for(;;){
+			switch(*++fmt){
+				case '-': spec.flags |= FMT_LEFT; continue;
+				case '0': spec.flags |= FMT_ZERO; continue;
+				case '+': spec.flags |= FMT_PLUS; continue;
+				case ' ': spec.flags |= FMT_SPACE; continue;
+				case '#': spec.flags |= FMT_ALT; continue;
+			}
+			break;
+		}
+
+		spec.width = 0;
+		if(*fmt == '*'){
+			spec.width = va_arg(ap, int);
+			if(spec.width < 0){
+				spec.flags |= FMT_LEFT;
+				spec.width = -spec.width;
+			}
+			++fmt;
+		}else{
+			for(; *fmt >= '0' && *fmt <= '9'; ++fmt)
+				spec.width = spec.width * 10 + (*fmt - '0');
+		}
+
+		spec.precision = -1;
+		if(*fmt == '.'){
+			++fmt;
+			spec.precision = 0;
+			if(*fmt == '*'){
+				spec.precision = va_arg(ap, int);
+				++fmt;
+			}else{
+				for(; *fmt >= '0' && *fmt <= '9'; ++fmt)
+					spec.precision = spec.precision * 10 + (*fmt - '0');
 			}
-			/* Skip the next character */
-			++i;
-		}else
-			fio_write(fd, format+i, 1);
+		}
+
+		/* 0 int, 1 long, 2 long long. char and short arrive promoted. */
+		length = 0;
+		for(;; ++fmt){
+			if(*fmt == 'h')
+				continue;
+			if(*fmt == 'l')
+				++length;
+			else if(*fmt == 'z')
+				length = (sizeof(size_t) == sizeof(long)) ? 1 : 0;
+			else
+				break;
+		}
+
+		base = 10;
+		negative = 0;
+		switch(*fmt){
+			case 'd':
+			case 'i':
+				if(length >= 2)
+					snum = va_arg(ap, long long);
+				else if(length == 1)
+					snum = va_arg(ap, long);
+				else
+					snum = va_arg(ap, int);
+				negative = snum < 0;
+				num = negative ? -(unsigned long long)snum : (unsigned long long)snum;
+				format_number(out, &spec, num, negative, base);
+				break;
+			case 'X':
+				spec.flags |= FMT_UPPER;
+				/* fall through */
+			case 'x':
+				base = 16;
+				goto unsigned_number;
+			case 'o':
+				base = 8;
+				/* fall through */
+			case 'u':
+			unsigned_number:
+				if(length >= 2)
+					num = va_arg(ap, unsigned long long);
+				else if(length == 1)
+					num = va_arg(ap, unsigned long);
+				else
+					num = va_arg(ap, unsigned int);
+				format_number(out, &spec, num, 0, base);
+				break;
+			case 'p':
+				spec.flags |= FMT_ALT;
+				format_number(out, &spec, (uintptr_t)va_arg(ap, void *), 0, 16);
+				break;
+			case 'c':
+				{
+					char c[2] = { (char)va_arg(ap, int), '\0' };
+					spec.precision = 1;
+					/* %c of '\0' still prints one character */
+					if(!c[0]){
+						format_repeat(out, ' ', (spec.flags & FMT_LEFT) ? 0 : spec.width - 1);
+						format_putc(out, '\0');
+						format_repeat(out, ' ', (spec.flags & FMT_LEFT) ? spec.width - 1 : 0);
+					}else
+						format_string(out, &spec, c);
+				}
+				break;
+			case 's':
+				format_string(out, &spec, va_arg(ap, const char *));
+				break;
+			case '%':
+				format_putc(out, '%');
+				break;
+			case '\0':
+				/* A lone % at the end of the format */
+				return;
+			default:
+				/* Unknown conversion, print it as is */
+				format_putc(out, '%');
+				format_putc(out, *fmt);
+				break;
+		}
 	}
+}
+
+size_t vfio_printf(int fd, const char *format, va_list ap){
+	char buf[FIO_PRINTF_BUFFER];
+	format_out_t out = { buf, sizeof(buf), 0, 0, fd };
+
+	vformat(&out, format, ap);
+	format_flush(&out);
+	return out.count;
+}
 
-	va_end(v1);
+size_t fio_printf(int fd, const char *format, ...){
+	va_list ap;
+	size_t count;
+
+	va_start(ap, format);
+	count = vfio_printf(fd, format, ap);
+	va_end(ap);
+	return count;
+}
+
+int vsnprintf(char *dest, size_t size, const char *format, va_list ap){
+	format_out_t out = { dest, size ? size - 1 : 0, 0, 0, -1 };
+
+	vformat(&out, format, ap);
+	if(size)
+		dest[out.pos] = '\0';
+	return out.count;
+}
+
+int snprintf(char *dest, size_t size, const char *format, ...){
+	va_list ap;
+	int count;
+
+	va_start(ap, format);
+	count = vsnprintf(dest, size, format, ap);
+	va_end(ap);
 	return count;
 }
 
 int sprintf(char *dest, const char *format, ...){
-        int i,count=0, p;
-
-        va_list(v1);
-        va_start(v1, format);
-
-        int tmpint;
-        char *tmpcharp;
-	char tmpchar;
-
-        for(i=0, p=0; format[i]; ++i){
-                if(format[i]=='%'){
-                        switch(format[i+1]){
-                                case '%':
-                                        dest[p++]='%'; break;
-                                case 'd':
-                                case 'x':
-				case 'X':
-				case 'u':
-                                        tmpint = va_arg(v1, int);
-                                        if(format[i+1]=='u')	
-						tmpcharp = utoa(format[i+1]=='X'?"0123456789ABCDEF":"0123456789abcdef" ,(unsigned)tmpint, 10);
-					else
-						tmpcharp = itoa(format[i+1]=='X'?"0123456789ABCDEF":"0123456789abcdef", tmpint, format[i+1]=='d'?10: 16);
-                                        //fio_write(fd, tmpcharp, 3);i
-					for(;*tmpcharp;++tmpcharp, ++p)
-						dest[p]=*tmpcharp;
-                                        break;
-                                case 's':
-                                        tmpcharp = va_arg(v1, char *);
-					for(;*tmpcharp;++tmpcharp, ++p)
-						dest[p]=*tmpcharp;
-					break;
-				case 'c':
-					tmpchar = va_arg(v1, int);
-					dest[p++]=tmpchar;
-                                        break;
-                        }
-                        /* Skip the next character */
-                        ++i;
-                }else
-                        dest[p++]=format[i];
-        }
-
-        va_end(v1);
-	dest[p]='\0';
-        return count;
+	va_list ap;
+	int count;
+
+	va_start(ap, format);
+	count = vsnprintf(dest, (size_t)-1, format, ap);
+	va_end(ap);
+	return count;
 }
 
 
@@ -142,7 +357,10 @@ void* malloc(size_t size){
 }
 
 void* calloc(size_t nmemb, size_t size){
-    return malloc(nmemb * size);
+    void* ptr = malloc(nmemb * size);
+    if(ptr)
+        memset(ptr, 0, nmemb * size);
+    return ptr;
 }
 
 void free(void* ptr){
@@ -6,6 +6,7 @@
 #include "filesystem.h"
 #include "osdebug.h"
 #include "hash-djb2.h"
+#include "serial.h"
 
 superblock_t dev_superblock = {
     .device = 0xDEADBEEF,
@@ -58,7 +59,8 @@ inode_t devfs_stdout_node = {
         NULL,
         NULL,
         stdout_write,
-        NULL
+        NULL,
+        .writev = stdout_writev
     },
     NULL
 };
@@ -79,7 +81,8 @@ inode_t devfs_stderr_node = {
         NULL,
         NULL,
         stdout_write,
-        NULL
+        NULL,
+        .writev = stdout_writev
     },
     NULL
 };
@@ -112,63 +115,17 @@ fs_type_t devfs_r = {
     .next = NULL,
 };
 
-/* recv_byte is define in main.c */
-char recv_byte();
-void send_byte(char);
-
-enum KeyName{ESC=27, BACKSPACE=127};
-
-/* Imple */
+/* Line editing is done by the serial line discipline */
 ssize_t stdin_read(struct inode_t* node, void* buf, size_t count, off_t offset) {
-    int i=0, endofline=0, last_chr_is_esc;
-    char *ptrbuf=buf;
-    char ch;
-    while(i < count&&endofline!=1){
-	ptrbuf[i]=recv_byte();
-	switch(ptrbuf[i]){
-		case '\r':
-		case '\n':
-			ptrbuf[i]='\0';
-			endofline=1;
-			break;
-		case '[':
-			if(last_chr_is_esc){
-				last_chr_is_esc=0;
-				ch=recv_byte();
-				if(ch>=1&&ch<=6){
-					ch=recv_byte();
-				}
-				continue;
-			}
-		case ESC:
-			last_chr_is_esc=1;
-			continue;
-		case BACKSPACE:
-			last_chr_is_esc=0;
-			if(i>0){
-				send_byte('\b');
-				send_byte(' ');
-				send_byte('\b');
-				--i;
-			}
-			continue;
-		default:
-			last_chr_is_esc=0;
-	}
-	send_byte(ptrbuf[i]);
-	++i;
-    }
-    return i;
+    return serial_read(buf, count);
 }
 
 ssize_t stdout_write(struct inode_t* node, const void* buf, size_t count, off_t offset) {
-    int i;
-    const char * data = (const char *) buf;
-    
-    for (i = 0; i < count; i++)
-        send_byte(data[i]);
-    
-    return count;
+    return serial_write(buf, count);
+}
+
+ssize_t stdout_writev(struct inode_t* node, const fio_iovec_t* iov, int iovcnt, off_t offset) {
+    return serial_writev(iov, iovcnt);
 }
 
 int devfs_root_lookup(struct inode_t* node, const char* path){
@@ -5,11 +5,30 @@
 #include <stdint.h>
 #include <string.h>
 #include <hash-djb2.h>
+#include <task.h>
 
 #define MAX_FS 16
-#define MAX_INODE_CACHE_SIZE 8
 #define MAX_FS_DEPTH 16
 
+#ifndef MAX_INODE_CACHE_SIZE
+#define MAX_INODE_CACHE_SIZE 32
+#endif
+
+/* Must be a power of 2 */
+#ifndef INODE_HASH_SIZE
+#define INODE_HASH_SIZE 16
+#endif
+
+/* Must be a power of 2 */
+#ifndef MAX_DCACHE_SIZE
+#define MAX_DCACHE_SIZE 32
+#endif
+
+/* Longer components are looked up without the cache */
+#ifndef DCACHE_NAME_MAX
+#define DCACHE_NAME_MAX 16
+#endif
+
 typedef struct fs_t {
     uint32_t used;
     superblock_t sb;
@@ -18,7 +37,100 @@ typedef struct fs_t {
 
 static struct fs_t fss[MAX_FS];
 static fs_type_t* reg_fss = NULL;
-static inode_t inode_pool[MAX_INODE_CACHE_SIZE];
+
+/* In-core inode cache. Every slot is either hashed by (device, number) and
+ * referenced, or sits on the LRU list waiting to be reused. Unreferenced
+ * inodes stay hashed so they can be revived without s_read_inode. */
+typedef struct icache_t{
+    inode_t inode;      /* Must be the first member */
+    uint32_t valid;
+    struct icache_t* hash_next;
+    struct icache_t* lru_prev;
+    struct icache_t* lru_next;
+}icache_t;
+
+static icache_t inode_pool[MAX_INODE_CACHE_SIZE];
+static icache_t* inode_hash[INODE_HASH_SIZE];
+static icache_t inode_lru;  /* Sentinel, least recently used first */
+static fs_icache_stat_t icache_stat;
+static xSemaphoreHandle icache_lock = NULL;
+
+/* Directory entry cache, maps (parent device, parent inode, component name)
+ * to the inode number i_lookup returned for it. The hash only picks the slot
+ * and rejects most misses early, a hit needs the name to match too. Only
+ * positive results are cached. */
+typedef struct dentry_t{
+    uint32_t used;
+    uint32_t p_device;
+    uint32_t p_number;
+    uint32_t hash;
+    uint32_t number;
+    uint8_t len;
+    char name[DCACHE_NAME_MAX];
+}dentry_t;
+
+static dentry_t dcache[MAX_DCACHE_SIZE];
+static fs_dcache_stat_t dcache_stat;
+
+static uint32_t dcache_index(uint32_t p_device, uint32_t p_number, uint32_t hash){
+    return (hash ^ (p_number * 31) ^ p_device) & (MAX_DCACHE_SIZE - 1);
+}
+
+static int32_t dcache_lookup(uint32_t p_device, uint32_t p_number, uint32_t hash,
+                             const char* name, uint32_t len){
+    dentry_t* ent = dcache + dcache_index(p_device, p_number, hash);
+    int32_t ret = -1;
+
+    taskENTER_CRITICAL();
+    if((ent->used) && (ent->hash == hash) && \
+       (ent->p_device == p_device) && (ent->p_number == p_number) && \
+       (ent->len == len) && !memcmp(ent->name, name, len)){
+        ret = ent->number;
+        dcache_stat.hits++;
+    }else{
+        dcache_stat.misses++;
+    }
+    taskEXIT_CRITICAL();
+
+    return ret;
+}
+
+static void dcache_insert(uint32_t p_device, uint32_t p_number, uint32_t hash,
+                          const char* name, uint32_t len, uint32_t number){
+    dentry_t* ent = dcache + dcache_index(p_device, p_number, hash);
+
+    if(len > DCACHE_NAME_MAX)
+        return;
+
+    taskENTER_CRITICAL();
+    if(ent->used)
+        dcache_stat.replaces++;
+    ent->used = 1;
+    ent->p_device = p_device;
+    ent->p_number = p_number;
+    ent->hash = hash;
+    ent->number = number;
+    ent->len = len;
+    memcpy(ent->name, name, len);
+    taskEXIT_CRITICAL();
+}
+
+void fs_dcache_invalidate(inode_t* parent){
+    taskENTER_CRITICAL();
+    for(uint32_t i = 0; i < MAX_DCACHE_SIZE; i++){
+        if(!parent || ((dcache[i].p_device == parent->device) && (dcache[i].p_number == parent->number)))
+            dcache[i].used = 0;
+    }
+    dcache_stat.invalidations++;
+    taskEXIT_CRITICAL();
+}
+
+void fs_dcache_stat(fs_dcache_stat_t* stat){
+    taskENTER_CRITICAL();
+    *stat = dcache_stat;
+    taskEXIT_CRITICAL();
+    stat->size = MAX_DCACHE_SIZE;
+}
 
 /*
 static inode_t* resolvePath(const char* path){
@@ -44,9 +156,68 @@ static inode_t* resolvePath(const char* path){
 }
 */
 
+static uint32_t icache_index(uint32_t device, uint32_t number){
+    return (number ^ (device * 31)) & (INODE_HASH_SIZE - 1);
+}
+
+static void icache_lru_remove(icache_t* ic){
+    ic->lru_prev->lru_next = ic->lru_next;
+    ic->lru_next->lru_prev = ic->lru_prev;
+    ic->lru_prev = ic->lru_next = NULL;
+}
+
+static void icache_lru_insert_tail(icache_t* ic){
+    ic->lru_prev = inode_lru.lru_prev;
+    ic->lru_next = &inode_lru;
+    inode_lru.lru_prev->lru_next = ic;
+    inode_lru.lru_prev = ic;
+}
+
+static void icache_lru_insert_head(icache_t* ic){
+    ic->lru_prev = &inode_lru;
+    ic->lru_next = inode_lru.lru_next;
+    inode_lru.lru_next->lru_prev = ic;
+    inode_lru.lru_next = ic;
+}
+
+static void icache_unhash(icache_t* ic){
+    icache_t** it = inode_hash + icache_index(ic->inode.device, ic->inode.number);
+
+    while(*it){
+        if(*it == ic){
+            *it = ic->hash_next;
+            break;
+        }
+        it = &(*it)->hash_next;
+    }
+    ic->hash_next = NULL;
+    ic->valid = 0;
+}
+
+static superblock_t* fs_get_sb(uint32_t device){
+    for(uint32_t i = 0; i < MAX_FS; i++){
+        if((fss[i].used) && (fss[i].sb.device == device))
+            return &fss[i].sb;
+    }
+    return NULL;
+}
+
+static int is_cached_inode(inode_t* inode){
+    return ((icache_t*)inode >= inode_pool) && ((icache_t*)inode < inode_pool + MAX_INODE_CACHE_SIZE);
+}
+
 __attribute__((constructor)) void fs_init() {
     memset(fss, 0, sizeof(fss));
     memset(inode_pool, 0, sizeof(inode_pool));
+    memset(inode_hash, 0, sizeof(inode_hash));
+    memset(&icache_stat, 0, sizeof(icache_stat));
+    inode_lru.lru_prev = inode_lru.lru_next = &inode_lru;
+    for(uint32_t i = 0; i < MAX_INODE_CACHE_SIZE; i++)
+        icache_lru_insert_tail(inode_pool + i);
+    if(icache_lock == NULL)
+        icache_lock = xSemaphoreCreateMutex();
+    memset(dcache, 0, sizeof(dcache));
+    memset(&dcache_stat, 0, sizeof(dcache_stat));
 }
 
 int register_fs(fs_type_t* type) {
@@ -57,6 +228,7 @@ int register_fs(fs_type_t* type) {
 
 int fs_mount(inode_t* mountpoint, uint32_t type, void* opaque){
     uint32_t i;
+    int ret;
 
     fs_type_t* it = reg_fss;
     fs_t* ptr = NULL;
@@ -82,11 +254,21 @@ int fs_mount(inode_t* mountpoint, uint32_t type, void* opaque){
                 return -3;
             ptr->used = 1;
             ptr->sb.covered = mountpoint;
+            fs_dcache_invalidate(NULL);
             if(mountpoint){
                 mountpoint->mode |= 2; //set mountpoint as covered
                 mountpoint->count++;
             }
-            return it->rsbcb(opaque, &ptr->sb);
+            ret = it->rsbcb(opaque, &ptr->sb);
+            if(ret){
+                /* Rejected, give back the slot and the mountpoint */
+                if(mountpoint){
+                    mountpoint->mode &= ~2;
+                    mountpoint->count--;
+                }
+                memset(ptr, 0, sizeof(fs_t));
+            }
+            return ret;
         }
         it = it->next;
     } 
@@ -94,45 +276,91 @@ int fs_mount(inode_t* mountpoint, uint32_t type, void* opaque){
 }
 
 inode_t* fs_open_inode(uint32_t device, uint32_t number){
-    for(uint32_t i = 0; i < MAX_INODE_CACHE_SIZE; i++){
-        if((inode_pool[i].device == device) && (inode_pool[i].number == number)){
-            inode_pool[i].count++;
-            return inode_pool + i;
+    icache_t* ic;
+    superblock_t* sb;
+    rwlock_t* lock;
+
+    xSemaphoreTake(icache_lock, portMAX_DELAY);
+
+    for(ic = inode_hash[icache_index(device, number)]; ic; ic = ic->hash_next){
+        if((ic->inode.device == device) && (ic->inode.number == number)){
+            if(ic->inode.count++ == 0)
+                icache_lru_remove(ic);
+            icache_stat.hits++;
+            xSemaphoreGive(icache_lock);
+            return &ic->inode;
         }
     }
+    icache_stat.misses++;
+
+    sb = fs_get_sb(device);
+    ic = inode_lru.lru_next;
+    if((!sb) || (ic == &inode_lru)){
+        if(sb)
+            icache_stat.failures++;
+        xSemaphoreGive(icache_lock);
+        return NULL;
+    }
 
-    for(uint32_t i = 0; i < MAX_FS; i++){
-        if((fss[i].used) && (fss[i].sb.device == device)){
-            for(uint32_t j = 0; j < MAX_INODE_CACHE_SIZE; j++){
-                if(inode_pool[j].count == 0){
-                    inode_pool[j].device = device;
-                    inode_pool[j].number = number;
-                    if(fss[i].sb.superblock_ops.s_read_inode(&inode_pool[j])){
-                        inode_pool[j].device = 0;
-                        inode_pool[j].number = 0;
-                        return NULL;
-                    }
-                    inode_pool[j].count++;
-                    if(inode_pool[j].lock == NULL)
-                        inode_pool[j].lock = xSemaphoreCreateMutex();
-                    return inode_pool + j;
-                }
-            }
-        }
+    icache_lru_remove(ic);
+    if(ic->valid){
+        /* Write back the victim before it is reused */
+        superblock_t* victim_sb = fs_get_sb(ic->inode.device);
+        if((victim_sb) && (victim_sb->superblock_ops.s_write_inode))
+            victim_sb->superblock_ops.s_write_inode(&ic->inode);
+        icache_unhash(ic);
+        icache_stat.evictions++;
     }
 
-    return NULL;
+    /* s_read_inode may overwrite the whole inode, keep the lock */
+    lock = ic->inode.lock;
+    memset(&ic->inode, 0, sizeof(inode_t));
+    ic->inode.device = device;
+    ic->inode.number = number;
+    if(sb->superblock_ops.s_read_inode(&ic->inode)){
+        ic->inode.lock = lock;
+        icache_lru_insert_head(ic);
+        xSemaphoreGive(icache_lock);
+        return NULL;
+    }
+    ic->inode.device = device;
+    ic->inode.number = number;
+    ic->inode.count = 1;
+    ic->inode.lock = (lock != NULL) ? lock : rwlock_create();
+
+    ic->valid = 1;
+    ic->hash_next = inode_hash[icache_index(device, number)];
+    inode_hash[icache_index(device, number)] = ic;
+
+    xSemaphoreGive(icache_lock);
+    return &ic->inode;
 }
 
 void fs_close_inode(inode_t* inode){
     //Should i_ops close 
-    inode->count--;
+    if(!is_cached_inode(inode)){
+        inode->count--;
+        return;
+    }
+
+    xSemaphoreTake(icache_lock, portMAX_DELAY);
+    if(--inode->count == 0)
+        icache_lru_insert_tail((icache_t*)inode);
+    xSemaphoreGive(icache_lock);
     return;
 }
 
+void fs_icache_stat(fs_icache_stat_t* stat){
+    xSemaphoreTake(icache_lock, portMAX_DELAY);
+    *stat = icache_stat;
+    xSemaphoreGive(icache_lock);
+    stat->size = MAX_INODE_CACHE_SIZE;
+}
+
 int fs_open(const char* path, inode_t** inode){
-    inode_t *ptr, *ptr2;
+    inode_t *ptr = NULL, *ptr2;
     int32_t ret;
+    uint32_t hash, len;
 
     const char * slash = path;
 
@@ -142,7 +370,12 @@ int fs_open(const char* path, inode_t** inode){
             break;
         }
     }
-    
+
+    if(!ptr){
+        *inode = NULL;
+        return -1;
+    }
+
     slash = path;
     while(1){
         
@@ -152,6 +385,10 @@ int fs_open(const char* path, inode_t** inode){
                     ptr2 = ptr;
                     ptr = fs_open_inode(fss[i].sb.device, fss[i].sb.mounted);
                     fs_close_inode(ptr2);
+                    if(!ptr){
+                        *inode = NULL;
+                        return -1;
+                    }
                 }
             }
         }
@@ -162,14 +399,24 @@ int fs_open(const char* path, inode_t** inode){
         slash++;
 
         ptr2 = ptr;
-        ret = ptr->inode_ops.i_lookup(ptr, slash);
+        len = strchr(slash, '/') ? (uint32_t)(strchr(slash, '/') - slash) : strlen(slash);
+        hash = hash_djb2((const uint8_t*)slash, len);
+        ret = dcache_lookup(ptr->device, ptr->number, hash, slash, len);
         if(ret < 0){
-            *inode = NULL;
-            fs_close_inode(ptr);
-            return -1;
+            ret = ptr->inode_ops.i_lookup(ptr, slash);
+            if(ret < 0){
+                *inode = NULL;
+                fs_close_inode(ptr);
+                return -1;
+            }
+            dcache_insert(ptr->device, ptr->number, hash, slash, len, ret);
         }
         ptr = fs_open_inode(ptr->device, ret);
         fs_close_inode(ptr2);
+        if(!ptr){
+            *inode = NULL;
+            return -1;
+        }
     }
     
     *inode = ptr;
@@ -200,17 +447,19 @@ int fs_mkdir(const char * path) {
     if(!ret){
         target_node = p_inode->inode_ops.i_lookup(p_inode, fn_buf);
 
-        if(!target_node){
+        if(target_node >= 0){
+            fs_close_inode(p_inode);
             return -1;
         }else{
             if(p_inode->inode_ops.i_mkdir){
-                xSemaphoreTake(p_inode->lock, portMAX_DELAY);
+                rwlock_write_lock(p_inode->lock);
                 if(p_inode->inode_ops.i_mkdir(p_inode, fn_buf)){
-                    xSemaphoreGive(p_inode->lock);
+                    rwlock_write_unlock(p_inode->lock);
                     fs_close_inode(p_inode);
                     return -3;       
                 }else{
-                    xSemaphoreGive(p_inode->lock);
+                    fs_dcache_invalidate(p_inode);
+                    rwlock_write_unlock(p_inode->lock);
                     fs_close_inode(p_inode);
                     return 0;       
                 }
@@ -8,6 +8,7 @@
 #include "filesystem.h"
 #include "osdebug.h"
 #include "hash-djb2.h"
+#include "rwlock.h"
 
 static struct fddef_t fio_fds[MAX_FDS];
 static struct dddef_t fio_dds[MAX_DDS];
@@ -56,6 +57,99 @@ static int fio_finddd() {
     return -1;
 }
 
+static void fio_buf_init(struct fddef_t * f, int mode) {
+    f->buf_mode = mode;
+    f->buf_owned = 0;
+    f->buf_dirty = 0;
+    f->buf = NULL;
+    f->buf_size = FIO_BUFSIZ;
+    f->buf_len = 0;
+    f->buf_base = 0;
+}
+
+/* Files that can be mapped are already in memory, a buffer would only add
+ * a copy and a heap allocation. Character devices are line buffered and
+ * everything else, e.g. /host, fully buffered. */
+static int fio_buf_mode(const inode_t * inode) {
+    if (inode->file_ops.map)
+        return FIO_IONBF;
+    return inode->block_size ? FIO_IOFBF : FIO_IOLBF;
+}
+
+/* Writes out pending output and drops any read ahead, the caller holds
+ * the inode lock */
+static int fio_flush_int(struct fddef_t * f) {
+    ssize_t r = 0;
+
+    if (f->buf_dirty && f->buf_len)
+        r = f->inode->file_ops.write(f->inode, f->buf, f->buf_len, f->buf_base);
+    f->buf_dirty = 0;
+    f->buf_len = 0;
+    return (r < 0) ? r : 0;
+}
+
+/* Buffers are allocated on first use, without memory the fd just goes
+ * unbuffered */
+static int fio_buf_get(struct fddef_t * f) {
+    if (f->buf_mode == FIO_IONBF)
+        return 0;
+    if (!f->buf) {
+        f->buf = malloc(f->buf_size);
+        if (!f->buf) {
+            f->buf_mode = FIO_IONBF;
+            return 0;
+        }
+        f->buf_owned = 1;
+    }
+    return 1;
+}
+
+/* fio_flush_devices() keeps the slots to visit in one word */
+typedef char fio_fds_fit_mask[(MAX_FDS <= 32) ? 1 : -1];
+
+static int fio_device_dirty(int fd, inode_t * inode, rwlock_t * lock) {
+    return (fio_fds[fd].inode == inode) && (inode->lock == lock) &&
+           fio_fds[fd].buf_dirty && !inode->block_size;
+}
+
+/* A prompt still sitting in a line buffer has to go out before we wait
+ * for the answer. Slots are only read under fio_sem, and checked again
+ * once the inode lock is held, as fio_close() may have cleared or reused
+ * them meanwhile. A dirty slot cannot be closed while we hold its lock. */
+static void fio_flush_devices() {
+    uint32_t dirty = 0;
+    inode_t * inode;
+    rwlock_t * lock;
+    int i, ok;
+
+    xSemaphoreTake(fio_sem, portMAX_DELAY);
+    for (i = 0; i < MAX_FDS; i++) {
+        if (fio_fds[i].inode && fio_device_dirty(i, fio_fds[i].inode, fio_fds[i].inode->lock))
+            dirty |= 1U << i;
+    }
+    xSemaphoreGive(fio_sem);
+
+    for (i = 0; dirty; i++, dirty >>= 1) {
+        if (!(dirty & 1))
+            continue;
+
+        xSemaphoreTake(fio_sem, portMAX_DELAY);
+        inode = fio_fds[i].inode;
+        lock = inode ? inode->lock : NULL;
+        xSemaphoreGive(fio_sem);
+        if (!lock)
+            continue;
+
+        rwlock_write_lock(lock);
+        xSemaphoreTake(fio_sem, portMAX_DELAY);
+        ok = fio_device_dirty(i, inode, lock);
+        xSemaphoreGive(fio_sem);
+        if (ok)
+            fio_flush_int(fio_fds + i);
+        rwlock_write_unlock(lock);
+    }
+}
+
 int fio_is_open(int fd) {
     int r = 0;
     xSemaphoreTake(fio_sem, portMAX_DELAY);
@@ -88,15 +182,16 @@ int fio_open(const char * path, int flags, int mode) {
     if(!ret){
         target_node = p_inode->inode_ops.i_lookup(p_inode, fn_buf);
 
-        if(target_node){
+        if(target_node < 0){
             if(p_inode->inode_ops.i_create){
-                xSemaphoreTake(p_inode->lock, portMAX_DELAY);
+                rwlock_write_lock(p_inode->lock);
                 if(p_inode->inode_ops.i_create(p_inode, fn_buf)){
-                    xSemaphoreGive(p_inode->lock);
+                    rwlock_write_unlock(p_inode->lock);
                     fs_close_inode(p_inode);
                     return -3;       
                 }else{
-                    xSemaphoreGive(p_inode->lock);
+                    fs_dcache_invalidate(p_inode);
+                    rwlock_write_unlock(p_inode->lock);
                     target_node = p_inode->inode_ops.i_lookup(p_inode, fn_buf);
                 }
             }else{
@@ -106,6 +201,10 @@ int fio_open(const char * path, int flags, int mode) {
         }
 
         f_inode = fs_open_inode(p_inode->device, target_node);
+        if(!f_inode){
+            fs_close_inode(p_inode);
+            return -5;
+        }
         
         if(f_inode->mode && 1){
             fs_close_inode(f_inode);
@@ -113,6 +212,12 @@ int fio_open(const char * path, int flags, int mode) {
             return -4;
         }
 
+        if((flags & O_TRUNC) && (f_inode->file_ops.truncate)){
+            rwlock_write_lock(f_inode->lock);
+            f_inode->file_ops.truncate(f_inode, 0);
+            rwlock_write_unlock(f_inode->lock);
+        }
+
         xSemaphoreTake(fio_sem, portMAX_DELAY);
         fd = fio_findfd();
             
@@ -122,6 +227,9 @@ int fio_open(const char * path, int flags, int mode) {
             fio_fds[fd].mode = mode;
             fio_fds[fd].cursor = 0;
             fio_fds[fd].opaque = NULL;
+            fio_fds[fd].bounce = NULL;
+            fio_fds[fd].bounce_size = 0;
+            fio_buf_init(fio_fds + fd, fio_buf_mode(f_inode));
         }
         xSemaphoreGive(fio_sem);
 
@@ -142,6 +250,8 @@ int fio_opendir(const char* path) {
 
     if(strcmp(path, "/") == 0){
         ret = fs_open(path, &p_inode);
+        if(ret)
+            return -1;
         xSemaphoreTake(fio_sem, portMAX_DELAY);
         dd = fio_finddd();
             
@@ -170,7 +280,8 @@ int fio_opendir(const char* path) {
         if(!ret){
             target_node = p_inode->inode_ops.i_lookup(p_inode, fn_buf);
 
-            if(!target_node){
+            if(target_node < 0){
+                fs_close_inode(p_inode);
                 return -1;
             }
 
@@ -203,22 +314,143 @@ int fio_opendir(const char* path) {
 }
 
 
-ssize_t fio_read(int fd, void * buf, size_t count) {
+/* Pending output has to reach the file before it is read back, which
+ * needs the lock exclusively */
+static void fio_flush_pending(struct fddef_t * f) {
+    if (f->buf_dirty) {
+        rwlock_write_lock(f->inode->lock);
+        fio_flush_int(f);
+        rwlock_write_unlock(f->inode->lock);
+    }
+}
+
+/* The caller holds the inode lock, shared is enough since only the fd's
+ * own read ahead is touched. An fd is not meant to be read by two tasks
+ * at once, two fds on the same file are fine. */
+static ssize_t fio_read_int(struct fddef_t * f, void * buf, size_t count) {
+    uint8_t * dst = (uint8_t *) buf;
     ssize_t r = 0;
-//    DBGOUT("fio_read(%i, %p, %i)\r\n", fd, buf, count);
-    if (fio_is_open_int(fd)) {
-        if (fio_fds[fd].inode->file_ops.read) {
-            xSemaphoreTake(fio_fds[fd].inode->lock, portMAX_DELAY);
-            r = fio_fds[fd].inode->file_ops.read(fio_fds[fd].inode, buf, count, fio_fds[fd].cursor);
-            fio_fds[fd].cursor += r;
-            xSemaphoreGive(fio_fds[fd].inode->lock);
+    size_t n, done = 0;
+
+    if ((f->buf_mode != FIO_IOFBF) || !fio_buf_get(f)) {
+        r = f->inode->file_ops.read(f->inode, buf, count, f->cursor);
+        if (r > 0)
+            f->cursor += r;
+        return r;
+    }
+
+    while (done < count) {
+        if ((f->cursor >= f->buf_base) && (f->cursor < f->buf_base + f->buf_len)) {
+            n = f->buf_base + f->buf_len - f->cursor;
+            if (n > count - done)
+                n = count - done;
+            memcpy(dst + done, f->buf + (f->cursor - f->buf_base), n);
+            f->cursor += n;
+            done += n;
+            continue;
         }
-    } else {
-        r = -2;
+
+        /* Reads at least a buffer long go straight to the file */
+        if (count - done >= f->buf_size) {
+            r = f->inode->file_ops.read(f->inode, dst + done, count - done, f->cursor);
+            if (r > 0) {
+                f->cursor += r;
+                done += r;
+            }
+            break;
+        }
+
+        r = f->inode->file_ops.read(f->inode, f->buf, f->buf_size, f->cursor);
+        if (r <= 0) {
+            f->buf_len = 0;
+            break;
+        }
+        f->buf_base = f->cursor;
+        f->buf_len = r;
     }
+
+    return done ? (ssize_t) done : r;
+}
+
+ssize_t fio_read(int fd, void * buf, size_t count) {
+    struct fddef_t * f;
+    ssize_t r;
+//    DBGOUT("fio_read(%i, %p, %i)\r\n", fd, buf, count);
+    if (!fio_is_open_int(fd))
+        return -2;
+    f = fio_fds + fd;
+    if (!f->inode->file_ops.read)
+        return 0;
+
+    if (!f->inode->block_size)
+        fio_flush_devices();
+    fio_flush_pending(f);
+
+    rwlock_read_lock(f->inode->lock);
+    r = fio_read_int(f, buf, count);
+    rwlock_read_unlock(f->inode->lock);
+
     return r;
 }
 
+ssize_t fio_pread(int fd, void * buf, size_t count, off_t offset) {
+    struct fddef_t * f;
+    ssize_t r;
+
+    if (!fio_is_open_int(fd))
+        return -2;
+    f = fio_fds + fd;
+    if (!f->inode->file_ops.read)
+        return 0;
+
+    if (!f->inode->block_size)
+        fio_flush_devices();
+    fio_flush_pending(f);
+
+    rwlock_read_lock(f->inode->lock);
+    r = f->inode->file_ops.read(f->inode, buf, count, offset);
+    rwlock_read_unlock(f->inode->lock);
+
+    return r;
+}
+
+ssize_t fio_readv(int fd, const fio_iovec_t * iov, int iovcnt) {
+    struct fddef_t * f;
+    ssize_t r = 0, done = 0;
+    int i;
+
+    if (!fio_is_open_int(fd))
+        return -2;
+    f = fio_fds + fd;
+    if (!f->inode->file_ops.read)
+        return 0;
+
+    if (!f->inode->block_size)
+        fio_flush_devices();
+    fio_flush_pending(f);
+
+    rwlock_read_lock(f->inode->lock);
+    if (f->inode->file_ops.readv && (f->buf_mode != FIO_IOFBF)) {
+        r = f->inode->file_ops.readv(f->inode, iov, iovcnt, f->cursor);
+        if (r > 0)
+            f->cursor += r;
+        rwlock_read_unlock(f->inode->lock);
+        return r;
+    }
+
+    /* Stop at the first short segment, like a short read */
+    for (i = 0; i < iovcnt; i++) {
+        r = fio_read_int(f, iov[i].base, iov[i].len);
+        if (r > 0)
+            done += r;
+        if (r < (ssize_t) iov[i].len)
+            break;
+    }
+    rwlock_read_unlock(f->inode->lock);
+
+    return done ? done : r;
+}
+
 
 ssize_t fio_readdir(int dd, struct dir_entity* ent) {
     ssize_t r = 0;
@@ -236,24 +468,164 @@ ssize_t fio_readdir(int dd, struct dir_entity* ent) {
 }
 
 
-ssize_t fio_write(int fd, const void * buf, size_t count) {
+/* The caller holds the inode lock */
+static ssize_t fio_write_int(struct fddef_t * f, const void * buf, size_t count) {
+    const uint8_t * src = (const uint8_t *) buf;
     ssize_t r = 0;
+    size_t i;
+
+    /* Read ahead is stale once we write */
+    if (!f->buf_dirty)
+        f->buf_len = 0;
+
+    if ((f->buf_mode == FIO_IONBF) || (count >= f->buf_size) || !fio_buf_get(f)) {
+        r = fio_flush_int(f);
+        if (r >= 0) {
+            r = f->inode->file_ops.write(f->inode, buf, count, f->cursor);
+            if (r > 0)
+                f->cursor += r;
+        }
+        return r;
+    }
+
+    if (f->buf_len + count > f->buf_size)
+        r = fio_flush_int(f);
+    if (r >= 0) {
+        if (!f->buf_len)
+            f->buf_base = f->cursor;
+        memcpy(f->buf + f->buf_len, buf, count);
+        f->buf_len += count;
+        f->buf_dirty = 1;
+        f->cursor += count;
+
+        if (f->buf_mode == FIO_IOLBF) {
+            for (i = 0; i < count; i++) {
+                if (src[i] == '\n') {
+                    r = fio_flush_int(f);
+                    break;
+                }
+            }
+        }
+    }
+
+    return (r < 0) ? r : (ssize_t) count;
+}
+
+ssize_t fio_write(int fd, const void * buf, size_t count) {
+    struct fddef_t * f;
+    ssize_t r;
 //    DBGOUT("fio_write(%i, %p, %i)\r\n", fd, buf, count);
-    if (fio_is_open_int(fd)) {
-        if (fio_fds[fd].inode->file_ops.write) {
-            xSemaphoreTake(fio_fds[fd].inode->lock, portMAX_DELAY);
-            r = fio_fds[fd].inode->file_ops.write(fio_fds[fd].inode, buf, count, fio_fds[fd].cursor);
-            fio_fds[fd].cursor += r;
-            xSemaphoreGive(fio_fds[fd].inode->lock);
-        } else {
-            r = -3;
+    if (!fio_is_open_int(fd))
+        return -2;
+    f = fio_fds + fd;
+    if (!f->inode->file_ops.write)
+        return -3;
+
+    rwlock_write_lock(f->inode->lock);
+    r = fio_write_int(f, buf, count);
+    rwlock_write_unlock(f->inode->lock);
+
+    return r;
+}
+
+ssize_t fio_writev(int fd, const fio_iovec_t * iov, int iovcnt) {
+    struct fddef_t * f;
+    ssize_t r = 0, done = 0;
+    size_t total = 0;
+    int i;
+
+    if (!fio_is_open_int(fd))
+        return -2;
+    f = fio_fds + fd;
+    if (!f->inode->file_ops.write)
+        return -3;
+
+    for (i = 0; i < iovcnt; i++)
+        total += iov[i].len;
+
+    rwlock_write_lock(f->inode->lock);
+    /* Small gathers still go through the buffer, the rest is handed to
+     * the filesystem in one call */
+    if (f->inode->file_ops.writev && ((f->buf_mode == FIO_IONBF) || (total >= f->buf_size))) {
+        if (!f->buf_dirty)
+            f->buf_len = 0;
+        r = fio_flush_int(f);
+        if (r >= 0) {
+            r = f->inode->file_ops.writev(f->inode, iov, iovcnt, f->cursor);
+            if (r > 0)
+                f->cursor += r;
         }
-    } else {
-        r = -2;
+        rwlock_write_unlock(f->inode->lock);
+        return r;
+    }
+
+    for (i = 0; i < iovcnt; i++) {
+        r = fio_write_int(f, iov[i].base, iov[i].len);
+        if (r > 0)
+            done += r;
+        if (r < (ssize_t) iov[i].len)
+            break;
     }
+    rwlock_write_unlock(f->inode->lock);
+
+    return done ? done : r;
+}
+
+ssize_t fio_pwrite(int fd, const void * buf, size_t count, off_t offset) {
+    struct fddef_t * f;
+    ssize_t r;
+
+    if (!fio_is_open_int(fd))
+        return -2;
+    f = fio_fds + fd;
+    if (!f->inode->file_ops.write)
+        return -3;
+
+    rwlock_write_lock(f->inode->lock);
+    /* Also drops read ahead that this write may make stale */
+    r = fio_flush_int(f);
+    if (r >= 0)
+        r = f->inode->file_ops.write(f->inode, buf, count, offset);
+    rwlock_write_unlock(f->inode->lock);
+
     return r;
 }
 
+int fio_flush(int fd) {
+    int r;
+
+    if (!fio_is_open_int(fd))
+        return -2;
+
+    rwlock_write_lock(fio_fds[fd].inode->lock);
+    r = fio_flush_int(fio_fds + fd);
+    if ((r >= 0) && fio_fds[fd].inode->file_ops.flush)
+        r = fio_fds[fd].inode->file_ops.flush(fio_fds[fd].inode);
+    rwlock_write_unlock(fio_fds[fd].inode->lock);
+    return r;
+}
+
+int fio_setvbuf(int fd, void * buf, int mode, size_t size) {
+    struct fddef_t * f;
+
+    if (!fio_is_open_int(fd))
+        return -2;
+    if ((mode < FIO_IONBF) || (mode > FIO_IOFBF) || (buf && !size))
+        return -1;
+    f = fio_fds + fd;
+
+    rwlock_write_lock(f->inode->lock);
+    fio_flush_int(f);
+    if (f->buf_owned)
+        free(f->buf);
+    f->buf = (uint8_t *) buf;
+    f->buf_owned = 0;
+    f->buf_size = size ? size : FIO_BUFSIZ;
+    f->buf_mode = mode;
+    rwlock_write_unlock(f->inode->lock);
+    return 0;
+}
+
 off_t fio_seek(int fd, off_t offset, int whence) {
 //    DBGOUT("fio_seek(%i, %i, %i)\r\n", fd, offset, whence);
     if (fio_is_open_int(fd)) {
@@ -279,6 +651,10 @@ off_t fio_seek(int fd, off_t offset, int whence) {
         if(!fio_fds[fd].inode->file_ops.lseek)
             return -1;
 
+        rwlock_write_lock(fio_fds[fd].inode->lock);
+        fio_flush_int(fio_fds + fd);
+        rwlock_write_unlock(fio_fds[fd].inode->lock);
+
         offset = fio_fds[fd].inode->file_ops.lseek(fio_fds[fd].inode, offset);
 
         xSemaphoreTake(fio_sem, portMAX_DELAY);
@@ -317,8 +693,17 @@ int fio_close(int fd) {
     if (fio_is_open_int(fd)) {
 //        if (fio_fds[fd].fdclose)
   //          r = fio_fds[fd].fdclose(fio_fds[fd].opaque);
+        rwlock_write_lock(fio_fds[fd].inode->lock);
+        r = fio_flush_int(fio_fds + fd);
+        if (fio_fds[fd].inode->file_ops.flush)
+            fio_fds[fd].inode->file_ops.flush(fio_fds[fd].inode);
+        rwlock_write_unlock(fio_fds[fd].inode->lock);
+
         xSemaphoreTake(fio_sem, portMAX_DELAY);
         fs_close_inode(fio_fds[fd].inode);
+        free(fio_fds[fd].bounce);
+        if (fio_fds[fd].buf_owned)
+            free(fio_fds[fd].buf);
         memset(fio_fds + fd, 0, sizeof(struct fddef_t));
         xSemaphoreGive(fio_sem);
     } else {
@@ -327,6 +712,63 @@ int fio_close(int fd) {
     return r;
 }
 
+ssize_t fio_map(int fd, off_t offset, size_t len, const void ** ptr) {
+    struct fddef_t * f;
+    inode_t * inode;
+    const void * next;
+    ssize_t r;
+
+    if (!fio_is_open_int(fd))
+        return -2;
+    f = fio_fds + fd;
+    inode = f->inode;
+
+    fio_flush_pending(f);
+
+    rwlock_read_lock(inode->lock);
+    /* The pointer outlives the lock, so only storage that never changes is
+     * handed out directly */
+    if (inode->file_ops.map && !inode->file_ops.write) {
+        r = inode->file_ops.map(inode, ptr, len, offset);
+        /* A short span is fine if it runs up to the end of the file */
+        if ((r <= 0) || (r == len) || (inode->file_ops.map(inode, &next, 1, offset + r) == 0)) {
+            rwlock_read_unlock(inode->lock);
+            return r;
+        }
+    }
+
+    if (!inode->file_ops.read) {
+        rwlock_read_unlock(inode->lock);
+        return -3;
+    }
+
+    if (f->bounce_size < len) {
+        free(f->bounce);
+        f->bounce = malloc(len);
+        f->bounce_size = f->bounce ? len : 0;
+        if (!f->bounce) {
+            rwlock_read_unlock(inode->lock);
+            return -4;
+        }
+    }
+
+    r = inode->file_ops.read(inode, f->bounce, len, offset);
+    if (r > 0)
+        *ptr = f->bounce;
+    rwlock_read_unlock(inode->lock);
+    return r;
+}
+
+/* Nothing to release, the bounce buffer is kept for the next fio_map and
+ * freed by fio_close */
+int fio_unmap(int fd, const void * ptr) {
+    (void)ptr;
+    if (!fio_is_open_int(fd))
+        return -2;
+
+    return 0;
+}
+
 int fio_closedir(int dd) {
 //    DBGOUT("fio_close(%i)\r\n", fd);
     if (fio_is_dir_open_int(dd)) {
@@ -377,13 +819,19 @@ static int devfs_open(void * opaque, const char * path, int flags, int mode) {
 */
 
 __attribute__((constructor)) void fio_init() {
+    /* Runs as a constructor and again from main(), the fds are set up once */
+    if(fio_sem != NULL)
+        return;
     memset(fio_fds, 0, sizeof(fio_fds));
     fio_fds[0].inode = get_stdin_node();
-    fio_fds[0].inode->lock = xSemaphoreCreateMutex();
+    fio_fds[0].inode->lock = rwlock_create();
     fio_fds[1].inode = get_stdout_node();
-    fio_fds[1].inode->lock = xSemaphoreCreateMutex();
+    fio_fds[1].inode->lock = rwlock_create();
     fio_fds[2].inode = get_stderr_node();
-    fio_fds[2].inode->lock = xSemaphoreCreateMutex();
+    fio_fds[2].inode->lock = rwlock_create();
+    fio_buf_init(fio_fds + 0, FIO_IONBF);
+    fio_buf_init(fio_fds + 1, FIO_IOLBF);
+    fio_buf_init(fio_fds + 2, FIO_IONBF);
     fio_sem = xSemaphoreCreateMutex();
 }
 
@@ -2,8 +2,7 @@
 #include "hash-djb2.h"
 #include "osdebug.h"
 
-uint32_t hash_djb2(const uint8_t * str, ssize_t _max) {
-    uint32_t hash = 5381;
+uint32_t hash_djb2_continue(uint32_t hash, const uint8_t * str, ssize_t _max) {
     uint32_t max = (uint32_t) _max;
     int c;
     
@@ -13,3 +12,7 @@ uint32_t hash_djb2(const uint8_t * str, ssize_t _max) {
     
     return hash;
 }
+
+uint32_t hash_djb2(const uint8_t * str, ssize_t _max) {
+    return hash_djb2_continue(HASH_DJB2_INIT, str, _max);
+}
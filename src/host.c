@@ -20,6 +20,9 @@ const hostcmdlist hcl[23]={
     [SYS_OPEN] = MKHCL(SYS_OPEN, open),
     [SYS_CLOSE] = MKHCL(SYS_CLOSE, close),
     [SYS_WRITE] = MKHCL(SYS_WRITE, write),
+    [SYS_READ] = MKHCL(SYS_READ, read),
+    [SYS_SEEK] = MKHCL(SYS_SEEK, seek),
+    [SYS_FLEN] = MKHCL(SYS_FLEN, flen),
     [SYS_SYSTEM] = MKHCL(SYS_SYSTEM, system),
 };
 
@@ -62,6 +65,27 @@ int host_write(va_list v1) {
     return host_call(SYS_WRITE, (param []){{.pdInt=va_arg(v1, int)}, {.pdPtr=va_arg(v1, void *)}, {.pdInt=va_arg(v1, int)}});
 }
 
+/* Returns the number of bytes that were not read, count at end of file */
+int host_read(va_list v1) {
+    int handle = va_arg(v1, int);
+    void *buf = va_arg(v1, void *);
+    int count = va_arg(v1, int);
+
+    return host_call(SYS_READ, (param []){{.pdInt=handle}, {.pdPtr=buf}, {.pdInt=count}});
+}
+
+/* Absolute position, 0 on success */
+int host_seek(va_list v1) {
+    int handle = va_arg(v1, int);
+    int pos = va_arg(v1, int);
+
+    return host_call(SYS_SEEK, (param []){{.pdInt=handle}, {.pdInt=pos}});
+}
+
+int host_flen(va_list v1) {
+    return host_call(SYS_FLEN, (param []){{.pdInt=va_arg(v1, int)}});
+}
+
 int host_action(enum HOST_SYSCALL action, ...)
 {
     int result;
@@ -0,0 +1,643 @@
+#include <string.h>
+#include <FreeRTOS.h>
+#include <semphr.h>
+#include <unistd.h>
+#include "fio.h"
+#include "filesystem.h"
+#include "hostfs.h"
+#include "host.h"
+#include "osdebug.h"
+
+#include "clib.h"
+
+/* Files on the debugger host, reached through ARM semihosting.
+ *
+ * Semihosting can open, read, write, seek and measure files but can not
+ * list or create directories, so readdir and mkdir are not supported and
+ * a path ending in '/' is trusted to be a directory. Each mount keeps a
+ * table of the host paths it has handed out inode numbers for, 0 is the
+ * mounted directory. An inode number is the table slot plus a generation
+ * that moves on whenever the slot is reused for another path, so a stale
+ * number fails instead of reaching the wrong file. */
+
+/* Semihosting open modes, index into "r", "rb", "r+", "r+b", "w", ... */
+#define HOST_MODE_RB 1
+#define HOST_MODE_RPB 3
+#define HOST_MODE_WPB 7
+
+typedef struct hostfs_node_t{
+    char path[HOSTFS_PATH_MAX];
+    int32_t handle;     /* -1 while closed */
+    uint32_t length;
+    uint32_t pos;       /* Host side position, saves a SYS_SEEK when sequential */
+    uint32_t number;
+    inode_t* inode;     /* icache entry while there is one */
+    uint8_t used;
+    uint8_t dir;
+    uint8_t writable;
+}hostfs_node_t;
+
+typedef struct hostfs_block_t{
+    int32_t node;       /* Slot, -1 when free */
+    uint32_t base;      /* File offset of data[0], block aligned */
+    uint32_t len;
+    uint32_t dirty_lo;  /* Pending write back, none when dirty_lo == dirty_hi */
+    uint32_t dirty_hi;
+    uint32_t stamp;
+    uint8_t* data;
+}hostfs_block_t;
+
+/* nodes and cache are allocated on the first lookup, a mount nobody uses
+ * only costs this struct and its lock */
+typedef struct hostfs_mount_t{
+    uint32_t device;
+    uint8_t mounted;
+    xSemaphoreHandle lock;
+    char root[HOSTFS_PATH_MAX];
+    hostfs_node_t* nodes;
+    uint32_t recycle;
+    hostfs_block_t blocks[HOSTFS_CACHE_BLOCKS];
+    uint8_t* cache;
+    uint32_t stamp;
+}hostfs_mount_t;
+
+static uint32_t device_count = 0xCCCC; //A magic Number
+static hostfs_mount_t hostfs_mounts[MAX_HOSTFS_MOUNTS];
+
+/* The caller holds the mount lock */
+static int mount_setup(hostfs_mount_t* mount){
+    if(mount->nodes)
+        return 0;
+
+    mount->nodes = (hostfs_node_t*)calloc(HOSTFS_MAX_NODES, sizeof(hostfs_node_t));
+    mount->cache = (uint8_t*)malloc(HOSTFS_CACHE_BLOCKS * HOSTFS_BLOCK_SIZE);
+    if((!mount->nodes) || (!mount->cache)){
+        free(mount->nodes);
+        free(mount->cache);
+        mount->nodes = NULL;
+        mount->cache = NULL;
+        return -1;
+    }
+
+    for(uint32_t i = 0; i < HOSTFS_CACHE_BLOCKS; i++){
+        memset(mount->blocks + i, 0, sizeof(hostfs_block_t));
+        mount->blocks[i].node = -1;
+        mount->blocks[i].data = mount->cache + i * HOSTFS_BLOCK_SIZE;
+    }
+    for(uint32_t i = 0; i < HOSTFS_MAX_NODES; i++)
+        mount->nodes[i].handle = -1;
+    strcpy(mount->nodes[0].path, mount->root);
+    mount->nodes[0].used = 1;
+    mount->nodes[0].dir = 1;
+    return 0;
+}
+
+static hostfs_node_t* node_get(hostfs_mount_t* mount, uint32_t number){
+    hostfs_node_t* node;
+
+    if(mount_setup(mount))
+        return NULL;
+    node = mount->nodes + (number % HOSTFS_MAX_NODES);
+    return ((node->used) && (node->number == number)) ? node : NULL;
+}
+
+static int hostfs_seek_to(hostfs_node_t* node, uint32_t offset){
+    if(node->pos == offset)
+        return 0;
+    if(host_action(SYS_SEEK, node->handle, offset)){
+        node->pos = 0xFFFFFFFF;
+        return -1;
+    }
+    node->pos = offset;
+    return 0;
+}
+
+static ssize_t hostfs_pread(hostfs_node_t* node, void* buf, uint32_t count, uint32_t offset){
+    int left;
+
+    if(hostfs_seek_to(node, offset))
+        return -1;
+    left = host_action(SYS_READ, node->handle, buf, count);
+    if((left < 0) || ((uint32_t)left > count)){
+        node->pos = 0xFFFFFFFF;
+        return -1;
+    }
+    node->pos += count - left;
+    return count - left;
+}
+
+static ssize_t hostfs_pwrite(hostfs_node_t* node, const void* buf, uint32_t count, uint32_t offset){
+    int left;
+
+    if(hostfs_seek_to(node, offset))
+        return -1;
+    left = host_action(SYS_WRITE, node->handle, (void*)buf, count);
+    if((left < 0) || ((uint32_t)left > count)){
+        node->pos = 0xFFFFFFFF;
+        return -1;
+    }
+    node->pos += count - left;
+    return count - left;
+}
+
+static int node_open(hostfs_node_t* node, int create){
+    int handle, length;
+
+    node->writable = 1;
+    if(create){
+        handle = host_action(SYS_OPEN, node->path, HOST_MODE_WPB);
+    }else{
+        handle = host_action(SYS_OPEN, node->path, HOST_MODE_RPB);
+        if(handle == -1){
+            node->writable = 0;
+            handle = host_action(SYS_OPEN, node->path, HOST_MODE_RB);
+        }
+    }
+    if(handle == -1)
+        return -1;
+
+    node->handle = handle;
+    node->pos = 0;
+    length = create ? 0 : host_action(SYS_FLEN, handle);
+    node->length = (length < 0) ? 0 : length;
+    return 0;
+}
+
+static void node_close(hostfs_node_t* node){
+    if(node->handle != -1)
+        host_action(SYS_CLOSE, node->handle);
+    node->handle = -1;
+}
+
+static int block_flush(hostfs_mount_t* mount, hostfs_block_t* b){
+    uint32_t len = b->dirty_hi - b->dirty_lo;
+    ssize_t r;
+
+    if(!len)
+        return 0;
+    r = hostfs_pwrite(mount->nodes + b->node, b->data + b->dirty_lo, len, b->base + b->dirty_lo);
+    /* Nobody is left to retry a failed write back, it is dropped */
+    b->dirty_lo = b->dirty_hi = 0;
+    return (r == (ssize_t)len) ? 0 : -1;
+}
+
+static int node_flush(hostfs_mount_t* mount, hostfs_node_t* node){
+    int32_t slot = node - mount->nodes;
+    int r = 0;
+
+    for(uint32_t i = 0; i < HOSTFS_CACHE_BLOCKS; i++){
+        if((mount->blocks[i].node == slot) && block_flush(mount, mount->blocks + i))
+            r = -1;
+    }
+    return r;
+}
+
+static void node_drop(hostfs_mount_t* mount, hostfs_node_t* node){
+    int32_t slot = node - mount->nodes;
+
+    for(uint32_t i = 0; i < HOSTFS_CACHE_BLOCKS; i++){
+        if(mount->blocks[i].node == slot){
+            mount->blocks[i].node = -1;
+            mount->blocks[i].dirty_lo = mount->blocks[i].dirty_hi = 0;
+        }
+    }
+}
+
+/* Cached block of node at base, a miss reads the whole block ahead */
+static hostfs_block_t* block_get(hostfs_mount_t* mount, hostfs_node_t* node, uint32_t base){
+    int32_t slot = node - mount->nodes;
+    hostfs_block_t* victim = mount->blocks;
+    hostfs_block_t* b;
+    ssize_t r;
+
+    for(uint32_t i = 0; i < HOSTFS_CACHE_BLOCKS; i++){
+        b = mount->blocks + i;
+        if((b->node == slot) && (b->base == base)){
+            b->stamp = ++mount->stamp;
+            return b;
+        }
+    }
+
+    for(uint32_t i = 1; (i < HOSTFS_CACHE_BLOCKS) && (victim->node != -1); i++){
+        b = mount->blocks + i;
+        if((b->node == -1) || (b->stamp < victim->stamp))
+            victim = b;
+    }
+    if(victim->node != -1)
+        block_flush(mount, victim);
+
+    victim->node = slot;
+    victim->base = base;
+    victim->len = 0;
+    victim->stamp = ++mount->stamp;
+    if(base < node->length){
+        r = hostfs_pread(node, victim->data, HOSTFS_BLOCK_SIZE, base);
+        if(r < 0){
+            victim->node = -1;
+            return NULL;
+        }
+        victim->len = r;
+    }
+    return victim;
+}
+
+static ssize_t hostfs_read(struct inode_t* inode, void* buf, size_t count, off_t offset) {
+    hostfs_mount_t* mount = (hostfs_mount_t*)inode->opaque;
+    uint8_t* dst = (uint8_t*)buf;
+    hostfs_node_t* node;
+    hostfs_block_t* b;
+    size_t done = 0;
+    uint32_t in, n;
+    ssize_t r = 0;
+
+    xSemaphoreTake(mount->lock, portMAX_DELAY);
+    node = node_get(mount, inode->number);
+    if((!node) || (node->dir)){
+        xSemaphoreGive(mount->lock);
+        return -2;
+    }
+    if((offset < 0) || ((uint32_t)offset >= node->length)){
+        xSemaphoreGive(mount->lock);
+        return 0;
+    }
+    if(count > node->length - offset)
+        count = node->length - offset;
+
+    if(count >= HOSTFS_BLOCK_SIZE){
+        /* One call for the whole span, pending writes have to land first */
+        node_flush(mount, node);
+        r = hostfs_pread(node, buf, count, offset);
+        xSemaphoreGive(mount->lock);
+        return r;
+    }
+
+    while(done < count){
+        b = block_get(mount, node, (offset + done) & ~(HOSTFS_BLOCK_SIZE - 1));
+        if(!b){
+            r = -1;
+            break;
+        }
+        in = offset + done - b->base;
+        if(in >= b->len)
+            break;
+        n = b->len - in;
+        if(n > count - done)
+            n = count - done;
+        memcpy(dst + done, b->data + in, n);
+        done += n;
+    }
+    xSemaphoreGive(mount->lock);
+
+    return done ? (ssize_t)done : r;
+}
+
+static ssize_t hostfs_write(struct inode_t* inode, const void* buf, size_t count, off_t offset) {
+    hostfs_mount_t* mount = (hostfs_mount_t*)inode->opaque;
+    const uint8_t* src = (const uint8_t*)buf;
+    hostfs_node_t* node;
+    hostfs_block_t* b;
+    size_t done = 0;
+    uint32_t in, lo, n;
+    ssize_t r = 0;
+
+    if(offset < 0)
+        return -1;
+
+    xSemaphoreTake(mount->lock, portMAX_DELAY);
+    node = node_get(mount, inode->number);
+    if((!node) || (node->dir) || (!node->writable)){
+        xSemaphoreGive(mount->lock);
+        return -2;
+    }
+
+    if(count >= HOSTFS_BLOCK_SIZE){
+        /* Cached copies would go stale, write them back and forget them */
+        node_flush(mount, node);
+        node_drop(mount, node);
+        r = hostfs_pwrite(node, buf, count, offset);
+        if((r > 0) && (offset + r > node->length))
+            node->length = offset + r;
+        xSemaphoreGive(mount->lock);
+        return r;
+    }
+
+    /* Write behind, the block goes to the host when it is evicted or flushed */
+    while(done < count){
+        b = block_get(mount, node, (offset + done) & ~(HOSTFS_BLOCK_SIZE - 1));
+        if(!b){
+            r = -1;
+            break;
+        }
+        in = offset + done - b->base;
+        n = HOSTFS_BLOCK_SIZE - in;
+        if(n > count - done)
+            n = count - done;
+
+        lo = in;
+        if(in > b->len){
+            memset(b->data + b->len, 0, in - b->len);
+            lo = b->len;
+        }
+        memcpy(b->data + in, src + done, n);
+        if(b->dirty_lo == b->dirty_hi){
+            b->dirty_lo = lo;
+            b->dirty_hi = in + n;
+        }else{
+            if(lo < b->dirty_lo)
+                b->dirty_lo = lo;
+            if(in + n > b->dirty_hi)
+                b->dirty_hi = in + n;
+        }
+        if(in + n > b->len)
+            b->len = in + n;
+        done += n;
+    }
+    if(offset + done > node->length)
+        node->length = offset + done;
+    xSemaphoreGive(mount->lock);
+
+    return done ? (ssize_t)done : r;
+}
+
+static int hostfs_flush(struct inode_t* inode) {
+    hostfs_mount_t* mount = (hostfs_mount_t*)inode->opaque;
+    hostfs_node_t* node;
+    int r = -1;
+
+    xSemaphoreTake(mount->lock, portMAX_DELAY);
+    node = node_get(mount, inode->number);
+    if(node)
+        r = node_flush(mount, node);
+    xSemaphoreGive(mount->lock);
+    return r;
+}
+
+/* Semihosting can only truncate by opening the file again */
+static int hostfs_truncate(struct inode_t* inode, off_t length) {
+    hostfs_mount_t* mount = (hostfs_mount_t*)inode->opaque;
+    hostfs_node_t* node;
+    int r = -2;
+
+    if(length)
+        return -1;
+
+    xSemaphoreTake(mount->lock, portMAX_DELAY);
+    node = node_get(mount, inode->number);
+    if((node) && (!node->dir) && (node->writable)){
+        node_drop(mount, node);
+        node_close(node);
+        r = node_open(node, 1);
+    }
+    xSemaphoreGive(mount->lock);
+    return r;
+}
+
+static off_t hostfs_seek(struct inode_t* inode, off_t offset) {
+    hostfs_mount_t* mount = (hostfs_mount_t*)inode->opaque;
+    hostfs_node_t* node;
+    uint32_t size = 0;
+
+    xSemaphoreTake(mount->lock, portMAX_DELAY);
+    node = node_get(mount, inode->number);
+    if(node)
+        size = node->length;
+    xSemaphoreGive(mount->lock);
+
+    if(offset > size)
+        offset = size;
+    if(offset < 0)
+        offset = 0;
+
+    return offset;
+}
+
+static int node_path(char* path, const hostfs_node_t* dir, const char* name, uint32_t len){
+    uint32_t dir_len = strlen(dir->path);
+
+    if(dir_len + 1 + len >= HOSTFS_PATH_MAX)
+        return -1;
+    strcpy(path, dir->path);
+    path[dir_len] = '/';
+    strncpy(path + dir_len + 1, name, len);
+    path[dir_len + 1 + len] = '\0';
+    return 0;
+}
+
+static hostfs_node_t* node_find(hostfs_mount_t* mount, const char* path, int dir){
+    for(uint32_t i = 0; i < HOSTFS_MAX_NODES; i++){
+        if((mount->nodes[i].used) && (mount->nodes[i].dir == dir) && !strcmp(mount->nodes[i].path, path))
+            return mount->nodes + i;
+    }
+    return NULL;
+}
+
+/* Takes a free slot, or round robin one whose inode nobody holds. The count
+ * is read without the icache lock, an fs_open_inode racing with the reuse
+ * gets an inode whose number no longer matches and fails. The old number
+ * may still sit in the dcache, *recycled tells the caller to drop it. */
+static hostfs_node_t* node_alloc(hostfs_mount_t* mount, const char* path, int* recycled){
+    hostfs_node_t* node = NULL;
+    uint32_t number;
+
+    for(uint32_t i = 1; i < HOSTFS_MAX_NODES; i++){
+        if(!mount->nodes[i].used){
+            node = mount->nodes + i;
+            break;
+        }
+    }
+    for(uint32_t i = 1; (!node) && (i < HOSTFS_MAX_NODES); i++){
+        mount->recycle = (mount->recycle % (HOSTFS_MAX_NODES - 1)) + 1;
+        if((!mount->nodes[mount->recycle].inode) || (!mount->nodes[mount->recycle].inode->count)){
+            node = mount->nodes + mount->recycle;
+            node_flush(mount, node);
+            node_drop(mount, node);
+            node_close(node);
+            *recycled = 1;
+        }
+    }
+    if(!node)
+        return NULL;
+
+    /* Never hand out a number twice, the icache may still know the old one */
+    number = node->number ? node->number + HOSTFS_MAX_NODES : (uint32_t)(node - mount->nodes);
+    if(number > 0x7FFFFFFF)
+        number = node - mount->nodes;
+
+    memset(node, 0, sizeof(hostfs_node_t));
+    strcpy(node->path, path);
+    node->number = number;
+    node->handle = -1;
+    node->used = 1;
+    return node;
+}
+
+int hostfs_i_lookup(struct inode_t* inode, const char* path){
+    hostfs_mount_t* mount = (hostfs_mount_t*)inode->opaque;
+    const char* slash = strchr(path, '/');
+    char full[HOSTFS_PATH_MAX];
+    hostfs_node_t* node;
+    int recycled = 0;
+    int32_t number = -2;
+
+    xSemaphoreTake(mount->lock, portMAX_DELAY);
+    node = node_get(mount, inode->number);
+    if((node) && (node->dir)){
+        number = -4;
+        if(!node_path(full, node, path, slash ? (uint32_t)(slash - path) : strlen(path))){
+            number = -3;
+            node = node_find(mount, full, slash != NULL);
+            if(!node){
+                node = node_alloc(mount, full, &recycled);
+                /* Only files can be checked for on the host */
+                if((node) && (slash == NULL) && node_open(node, 0)){
+                    node->used = 0;
+                    node = NULL;
+                }else if(node){
+                    node->dir = (slash != NULL);
+                }
+            }
+            if(node)
+                number = node->number;
+        }
+    }
+    xSemaphoreGive(mount->lock);
+
+    if(recycled)
+        fs_dcache_invalidate(NULL);
+    return number;
+}
+
+int hostfs_i_create(struct inode_t* inode, const char* fn){
+    hostfs_mount_t* mount = (hostfs_mount_t*)inode->opaque;
+    char full[HOSTFS_PATH_MAX];
+    hostfs_node_t* node;
+    int recycled = 0;
+    int r = -2;
+
+    xSemaphoreTake(mount->lock, portMAX_DELAY);
+    node = node_get(mount, inode->number);
+    if((node) && (node->dir)){
+        if(node_path(full, node, fn, strlen(fn)) || node_find(mount, full, 0)){
+            r = -4;
+        }else{
+            r = -3;
+            node = node_alloc(mount, full, &recycled);
+            if(node){
+                if(node_open(node, 1))
+                    node->used = 0;
+                else
+                    r = 0;
+            }
+        }
+    }
+    xSemaphoreGive(mount->lock);
+
+    if(recycled)
+        fs_dcache_invalidate(NULL);
+    return r;
+}
+
+int hostfs_read_inode(inode_t* inode){
+    hostfs_mount_t* mount;
+    hostfs_node_t* node;
+
+    for(uint32_t i = 0; i < MAX_HOSTFS_MOUNTS; i++){
+        mount = hostfs_mounts + i;
+        if((mount->mounted) && (mount->device == inode->device)){
+            /* The root is always there, it needs no node until a lookup */
+            if(inode->number){
+                xSemaphoreTake(mount->lock, portMAX_DELAY);
+                node = node_get(mount, inode->number);
+                if((!node) || (!node->dir && (node->handle == -1) && node_open(node, 0))){
+                    xSemaphoreGive(mount->lock);
+                    return -1;
+                }
+                node->inode = inode;
+                inode->mode = node->dir;
+                xSemaphoreGive(mount->lock);
+            }else{
+                inode->mode = 1;
+            }
+
+            inode->block_size = HOSTFS_BLOCK_SIZE;
+            inode->inode_ops.i_lookup = hostfs_i_lookup;
+            inode->inode_ops.i_create = hostfs_i_create;
+            inode->file_ops.lseek = hostfs_seek;
+            inode->file_ops.read = hostfs_read;
+            inode->file_ops.write = hostfs_write;
+            inode->file_ops.truncate = hostfs_truncate;
+            inode->file_ops.flush = hostfs_flush;
+            inode->opaque = mount;
+
+            return 0;
+        }
+    }
+
+    return -2;
+}
+
+/* Called when the icache evicts the inode, nobody holds it any more */
+int hostfs_write_inode(inode_t* inode){
+    hostfs_mount_t* mount = (hostfs_mount_t*)inode->opaque;
+    hostfs_node_t* node;
+    int r = 0;
+
+    xSemaphoreTake(mount->lock, portMAX_DELAY);
+    /* An unused mount has nothing to write back and stays unallocated */
+    node = mount->nodes ? node_get(mount, inode->number) : NULL;
+    if((node) && (node->inode == inode)){
+        r = node_flush(mount, node);
+        node_drop(mount, node);
+        node_close(node);
+        node->inode = NULL;
+    }
+    xSemaphoreGive(mount->lock);
+    return r;
+}
+
+int hostfs_read_superblock(void* opaque, struct superblock_t* sb){
+    const char* root = (const char*)opaque;
+    hostfs_mount_t* mount = NULL;
+
+    for(uint32_t i = 0; i < MAX_HOSTFS_MOUNTS; i++){
+        if(!hostfs_mounts[i].mounted){
+            mount = hostfs_mounts + i;
+            break;
+        }
+    }
+    if(!mount)
+        return -1;
+    if(strlen(root) >= HOSTFS_PATH_MAX)
+        return -2;
+
+    memset(mount, 0, sizeof(hostfs_mount_t));
+    mount->lock = xSemaphoreCreateMutex();
+    if(!mount->lock)
+        return -1;
+
+    strcpy(mount->root, root);
+    mount->mounted = 1;
+    mount->recycle = 0;
+    mount->stamp = 0;
+    mount->device = device_count++;
+
+    sb->device = mount->device;
+    sb->mounted = 0;
+    sb->block_size = HOSTFS_BLOCK_SIZE;
+    sb->type_hash = HOSTFS_TYPE;
+    sb->superblock_ops.s_read_inode = hostfs_read_inode;
+    sb->superblock_ops.s_write_inode = hostfs_write_inode;
+    sb->opaque = mount;
+    return 0;
+}
+
+static fs_type_t hostfs_r = {
+    .type_name_hash = HOSTFS_TYPE,
+    .rsbcb = hostfs_read_superblock,
+    .require_dev = 1,
+    .next = NULL,
+};
+
+void register_hostfs() {
+    register_fs(&hostfs_r);
+}
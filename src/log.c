@@ -0,0 +1,208 @@
+#include <string.h>
+#include <FreeRTOS.h>
+#include <semphr.h>
+#include <task.h>
+#include "log.h"
+#include "fio.h"
+#include "clib.h"
+
+/* Each record is a header word followed by the payload, padded to a word so
+ * headers never wrap. Producers reserve space by moving log_head with a
+ * compare and swap, copy the payload in and then publish the header with
+ * LOG_COMMITTED set. The flusher consumes committed records in order from
+ * log_tail and zeroes them, so unpublished space always reads as an empty
+ * header. A producer that stalls between reserve and publish holds back
+ * the records behind it until it is done. */
+#define LOG_COMMITTED 0x80000000
+#define LOG_MASK (LOG_RING_SIZE - 1)
+#define LOG_ALIGN(n) (((n) + 3) & ~3)
+
+#if LOG_BATCH_SIZE < LOG_RECORD_MAX
+#error "LOG_BATCH_SIZE has to hold the largest record"
+#endif
+
+static uint32_t log_ring[LOG_RING_SIZE / 4];
+static volatile uint32_t log_head = 0;
+static volatile uint32_t log_tail = 0;
+
+static log_stat_t log_stats;
+static volatile int log_sink = -1;
+static xSemaphoreHandle log_lock = NULL;
+static xSemaphoreHandle log_wake = NULL;
+
+/* Only touched with log_lock held */
+static uint8_t log_batch[LOG_BATCH_SIZE];
+
+static void ring_copy_in(uint32_t pos, const void* src, size_t len){
+    uint8_t* ring = (uint8_t*)log_ring;
+    uint32_t off = pos & LOG_MASK;
+    size_t first = (len < LOG_RING_SIZE - off) ? len : LOG_RING_SIZE - off;
+
+    memcpy(ring + off, src, first);
+    memcpy(ring, (const uint8_t*)src + first, len - first);
+}
+
+static void ring_copy_out(void* dst, uint32_t pos, size_t len){
+    uint8_t* ring = (uint8_t*)log_ring;
+    uint32_t off = pos & LOG_MASK;
+    size_t first = (len < LOG_RING_SIZE - off) ? len : LOG_RING_SIZE - off;
+
+    memcpy(dst, ring + off, first);
+    memcpy((uint8_t*)dst + first, ring, len - first);
+}
+
+static void ring_zero(uint32_t pos, size_t len){
+    uint8_t* ring = (uint8_t*)log_ring;
+    uint32_t off = pos & LOG_MASK;
+    size_t first = (len < LOG_RING_SIZE - off) ? len : LOG_RING_SIZE - off;
+
+    memset(ring + off, 0, first);
+    memset(ring, 0, len - first);
+}
+
+int log_write(const void* buf, size_t count){
+    uint32_t head, need, used, high;
+
+    if(count > LOG_RECORD_MAX)
+        count = LOG_RECORD_MAX;
+    need = 4 + LOG_ALIGN(count);
+
+    do{
+        head = log_head;
+        used = head - log_tail + need;
+        if(used > LOG_RING_SIZE){
+            __sync_fetch_and_add(&log_stats.dropped, 1);
+            return -1;
+        }
+    }while(!__sync_bool_compare_and_swap(&log_head, head, head + need));
+
+    ring_copy_in(head + 4, buf, count);
+    __sync_synchronize();
+    ((volatile uint32_t*)log_ring)[(head & LOG_MASK) / 4] = count | LOG_COMMITTED;
+
+    __sync_fetch_and_add(&log_stats.records, 1);
+    __sync_fetch_and_add(&log_stats.bytes, count);
+    do{
+        high = log_stats.high_water;
+    }while((used > high) && !__sync_bool_compare_and_swap(&log_stats.high_water, high, used));
+
+    /* Wake the flusher once per crossing of the half way mark */
+    if((log_wake) && (used > LOG_RING_SIZE / 2) && (used - need <= LOG_RING_SIZE / 2))
+        xSemaphoreGive(log_wake);
+    return count;
+}
+
+int vlog_printf(const char* fmt, va_list ap){
+    char buf[LOG_RECORD_MAX];
+    int n, r;
+
+    n = snprintf(buf, sizeof(buf), "[%u] ", (unsigned int)xTaskGetTickCount());
+    r = vsnprintf(buf + n, sizeof(buf) - n, fmt, ap);
+    if(r < 0)
+        return -1;
+    n += r;
+    if(n > (int)sizeof(buf) - 1)
+        n = sizeof(buf) - 1;
+    return log_write(buf, n);
+}
+
+int log_printf(const char* fmt, ...){
+    va_list ap;
+    int r;
+
+    va_start(ap, fmt);
+    r = vlog_printf(fmt, ap);
+    va_end(ap);
+    return r;
+}
+
+static void log_sink_write(int fd, size_t count){
+    if(fio_write(fd, log_batch, count) == (ssize_t)count)
+        log_stats.flushed += count;
+    else
+        log_stats.sink_errors++;
+}
+
+/* The caller holds log_lock */
+static void log_drain(){
+    uint32_t tail = log_tail;
+    uint32_t hdr, len, need;
+    int fd = log_sink;
+    size_t n = 0;
+
+    if(fd < 0)
+        return;
+
+    while(1){
+        hdr = ((volatile uint32_t*)log_ring)[(tail & LOG_MASK) / 4];
+        if(!(hdr & LOG_COMMITTED))
+            break;
+        __sync_synchronize();
+        len = hdr & ~LOG_COMMITTED;
+        need = 4 + LOG_ALIGN(len);
+
+        if(n + len > LOG_BATCH_SIZE){
+            log_sink_write(fd, n);
+            n = 0;
+        }
+        ring_copy_out(log_batch + n, tail + 4, len);
+        n += len;
+
+        ring_zero(tail, need);
+        __sync_synchronize();
+        tail += need;
+        log_tail = tail;
+    }
+
+    if(n){
+        log_sink_write(fd, n);
+        fio_flush(fd);
+    }
+}
+
+int log_flush(){
+    if(!log_lock)
+        return -1;
+
+    xSemaphoreTake(log_lock, portMAX_DELAY);
+    log_drain();
+    xSemaphoreGive(log_lock);
+    return 0;
+}
+
+static void log_flusher(void* arg){
+    while(1){
+        xSemaphoreTake(log_wake, LOG_FLUSH_PERIOD / portTICK_RATE_MS);
+        log_flush();
+    }
+}
+
+void log_init(){
+    if(log_lock)
+        return;
+
+    log_lock = xSemaphoreCreateMutex();
+    vSemaphoreCreateBinary(log_wake);
+    if(log_wake)
+        xSemaphoreTake(log_wake, 0);
+
+    xTaskCreate(log_flusher,
+                (signed portCHAR *) "log",
+                LOG_STACK_SIZE, NULL, tskIDLE_PRIORITY + LOG_PRIORITY, NULL);
+}
+
+int log_set_sink(int fd){
+    int old;
+
+    if(log_lock)
+        xSemaphoreTake(log_lock, portMAX_DELAY);
+    old = log_sink;
+    log_sink = fd;
+    if(log_lock)
+        xSemaphoreGive(log_lock);
+    return old;
+}
+
+void log_stat(log_stat_t* stat){
+    *stat = log_stats;
+}
@@ -11,13 +11,17 @@
 /* Filesystem includes */
 #include "filesystem.h"
 #include "fio.h"
-//#include "romfs.h"
+#include "romfs.h"
 #include "ramfs.h"
 #include "devfs.h"
+#include "hostfs.h"
+#include "log.h"
+#include "trace.h"
 
 #include "clib.h"
 #include "shell.h"
 #include "host.h"
+#include "serial.h"
 
 /* _sromfs symbol can be found in main.ld linker script
  * it contains file system structure of test_romfs directory
@@ -26,72 +30,23 @@ extern const unsigned char _sromfs;
 
 //static void setup_hardware();
 
-volatile xSemaphoreHandle serial_tx_wait_sem = NULL;
-/* Add for serial input */
-volatile xQueueHandle serial_rx_queue = NULL;
-
-/* IRQ handler to handle USART2 interruptss (both transmit and receive
- * interrupts). */
-void USART2_IRQHandler()
-{
-	static signed portBASE_TYPE xHigherPriorityTaskWoken;
-
-	/* If this interrupt is for a transmit... */
-	if (USART_GetITStatus(USART2, USART_IT_TXE) != RESET) {
-		/* "give" the serial_tx_wait_sem semaphore to notfiy processes
-		 * that the buffer has a spot free for the next byte.
-		 */
-		xSemaphoreGiveFromISR(serial_tx_wait_sem, &xHigherPriorityTaskWoken);
-
-		/* Diables the transmit interrupt. */
-		USART_ITConfig(USART2, USART_IT_TXE, DISABLE);
-		/* If this interrupt is for a receive... */
-	}else if(USART_GetITStatus(USART2, USART_IT_RXNE) != RESET){
-		char msg = USART_ReceiveData(USART2);
-
-		/* If there is an error when queueing the received byte, freeze! */
-		if(!xQueueSendToBackFromISR(serial_rx_queue, &msg, &xHigherPriorityTaskWoken))
-			while(1);
-	}
-	else {
-		/* Only transmit and receive interrupts should be enabled.
-		 * If this is another type of interrupt, freeze.
-		 */
-		while(1);
-	}
-
-	if (xHigherPriorityTaskWoken) {
-		taskYIELD();
-	}
-}
-
 void send_byte(char ch)
 {
-	/* Wait until the RS232 port can receive another byte (this semaphore
-	 * is "given" by the RS232 port interrupt when the buffer has room for
-	 * another byte.
-	 */
-	while (!xSemaphoreTake(serial_tx_wait_sem, portMAX_DELAY));
-
-	/* Send the byte and enable the transmit interrupt (it is disabled by
-	 * the interrupt).
-	 */
-	USART_SendData(USART2, ch);
-	USART_ITConfig(USART2, USART_IT_TXE, ENABLE);
+	serial_write(&ch, 1);
 }
 
-char recv_byte()
-{
-	USART_ITConfig(USART2, USART_IT_RXNE, ENABLE);
-	char msg;
-	while(!xQueueReceive(serial_rx_queue, &msg, portMAX_DELAY));
-	return msg;
-}
 void command_prompt(void *pvParameters)
 {
 	char buf[128];
 	char *argv[20];
     char hint[] = USER_NAME "@" USER_NAME "-STM32:~$ ";
+	/* Each command allocates from here, all of it is dropped when the
+	 * command returns */
+	static uint8_t scratch[SHELL_ARENA_SIZE];
+	static arena_t arena;
+
+	arena_init(&arena, scratch, sizeof(scratch));
+	cmd_arena = &arena;
 
 	fio_printf(1, "\rWelcome to FreeRTOS Shell\r\n");
 	while(1){
@@ -102,9 +57,10 @@ void command_prompt(void *pvParameters)
 
 		/* will return pointer to the command function */
 		cmdfunc *fptr=do_command(argv[0]);
-		if(fptr!=NULL)
+		if(fptr!=NULL){
 			fptr(n, argv);
-		else
+			arena_reset(&arena);
+		}else
 			fio_printf(2, "\r\n\"%s\" command not found.\r\n", argv[0]);
 	}
 
@@ -112,67 +68,70 @@ void command_prompt(void *pvParameters)
 
 void system_logger(void *pvParameters)
 {
-    signed char buf[128];
-    char output[512] = {0};
-    char *tag = "\nName          State   Priority  Stack  Num\n*******************************************\n";
-    int handle, error;
+    /* About 40 bytes per task, too much for the task's stack */
+    static signed char buf[512];
+    char *line, *end;
+    int fd;
     const portTickType xDelay = 100000 / 100;
 
-    handle = host_action(SYS_OPEN, "output/syslog", 4);
-    if(handle == -1) {
+    fd = fio_open("/host/output/syslog", O_CREAT | O_TRUNC, 0);
+    if(fd < 0) {
         fio_printf(1, "Open file error!\n");
-        return;
+        vTaskDelete(NULL);
     }
+    log_set_sink(fd);
 
     while(1) {
-        memcpy(output, tag, strlen(tag));
-        error = host_action(SYS_WRITE, handle, (void *)output, strlen(output));
-        if(error != 0) {
-            fio_printf(1, "Write file error! Remain %d bytes didn't write in the file.\n\r", error);
-            host_action(SYS_CLOSE, handle);
-            return;
-        }
         vTaskList(buf);
-
-        memcpy(output, (char *)(buf + 2), strlen((char *)buf) - 2);
-
-        error = host_action(SYS_WRITE, handle, (void *)buf, strlen((char *)buf));
-        if(error != 0) {
-            fio_printf(1, "Write file error! Remain %d bytes didn't write in the file.\n\r", error);
-            host_action(SYS_CLOSE, handle);
-            return;
+        log_printf("\nName          State   Priority  Stack  Num\n");
+        for(line = (char *)buf; *line; line = end) {
+            end = strchr(line, '\n');
+            end = end ? end + 1 : line + strlen(line);
+            log_write(line, end - line);
         }
 
         vTaskDelay(xDelay);
     }
-    
-    host_action(SYS_CLOSE, handle);
 }
 
 int main()
 {
 	init_rs232();
+	/* The RX ring semaphore and ldisc task must exist before RXNE fires */
+	serial_init();
 	enable_rs232_interrupts();
 	enable_rs232();
 	
 	fs_init();
 	fio_init();
+	fio_aio_init();
+	log_init();
     
     //register_fs(&ramfs_r);
     register_devfs();
     register_ramfs();
+    register_romfs();
+    register_hostfs();
     fs_mount(NULL, RAMFS_TYPE, NULL);
 
-//	register_romfs("romfs", &_sromfs);
-//	register_ramfs("ramfs");
-	
-	/* Create the queue used by the serial task.  Messages for write to
-	 * the RS232. */
-	vSemaphoreCreateBinary(serial_tx_wait_sem);
-	/* Add for serial input 
-	 * Reference: www.freertos.org/a00116.html */
-	serial_rx_queue = xQueueCreate(1, sizeof(char));
+    /* Read-only assets are served straight from flash */
+    inode_t* romfs_root;
+    fs_mkdir("/romfs/");
+    if(!fs_open("/romfs/", &romfs_root)){
+        fs_mount(romfs_root, ROMFS_TYPE, (void*)&_sromfs);
+        fs_close_inode(romfs_root);
+    }
 
+#if HOSTFS_MOUNT_AT_BOOT
+    /* Files of the debugger's working directory, nothing traps until used */
+    inode_t* host_root;
+    fs_mkdir("/host/");
+    if(!fs_open("/host/", &host_root)){
+        fs_mount(host_root, HOSTFS_TYPE, (void*)".");
+        fs_close_inode(host_root);
+    }
+#endif
+	
 	/* Create a task to output text read from romfs. */
 	xTaskCreate(command_prompt,
 	            (signed portCHAR *) "CLI",
@@ -193,4 +152,5 @@ int main()
 
 void vApplicationTickHook()
 {
+	trace_tick();
 }
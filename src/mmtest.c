@@ -1,143 +1,435 @@
+/* Allocator benchmark. Runs a fixed number of malloc/free operations of a
+ * workload profile against pvPortMalloc/vPortFree and reports the cycles
+ * per call as percentiles, the worst fragmentation seen and the failures.
+ *
+ * On the target it is the mmtest shell command and counts cycles with the
+ * DWT cycle counter, or SysTick when the core has none (QEMU). Built with
+ * MMTEST_NATIVE it is the host's mmbench (`make mmbench`), linked against
+ * the same portable/MemMang/heap_XX.c and timed in nanoseconds.
+ *
+ * A run is fully determined by the profile, the operation count and the
+ * seed, so two heaps or two builds can be compared run against run.
+ */
+#ifdef MMTEST_NATIVE
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#endif
+#include <stdint.h>
+#include <string.h>
+
 #include "FreeRTOS.h"
+#include "task.h"
+#include "heap_stats.h"
+
+#ifdef MMTEST_NATIVE
+#define mm_printf(...) printf(__VA_ARGS__)
+#define MM_NL "\n"
+#define MM_UNIT "ns"
+#else
+#include "stm32f10x.h"
 #include "fio.h"
 #include "clib.h"
+#define mm_printf(...) fio_printf(1, __VA_ARGS__)
+#define MM_NL "\r\n"
+#define MM_UNIT "cycles"
+#endif
 
-/* heap_XX.c */
-void *pvPortMalloc(size_t xWantedSize);
-void vPortFree(void *pv);
-size_t xPortGetFreeHeapSize(void);
+/* Most blocks alive at once */
+#define MM_SLOTS 128
+#define MM_DEFAULT_OPS 2000
+#define MM_DEFAULT_SEED 1
 
-struct slot {
-    void *pointer;
-    unsigned int size;
-    unsigned int lfsr;
-};
+/* Latency histogram, 8 linear buckets per power of 2, so a percentile is
+ * off by at most 1/8 of its value */
+#define MM_SUB_LOG2 3
+#define MM_SUB (1 << MM_SUB_LOG2)
+#define MM_BUCKETS ((32 - MM_SUB_LOG2 + 1) * MM_SUB)
+
+typedef struct mm_hist_t{
+    uint32_t count[MM_BUCKETS];
+    uint32_t n;
+    uint32_t sum;
+    uint32_t max;
+}mm_hist_t;
+
+typedef struct mm_slot_t{
+    uint8_t* ptr;
+    uint32_t size;
+    uint8_t tag;
+}mm_slot_t;
+
+typedef struct mm_run_t{
+    mm_hist_t malloc_lat;
+    mm_hist_t free_lat;
+    uint32_t ops;
+    uint32_t failures;
+    uint32_t corruptions;
+    uint32_t peak_frag;     /* Percent of the free bytes not in the largest block */
+    size_t min_free;
+    mm_slot_t slots[MM_SLOTS];
+}mm_run_t;
+
+static mm_run_t mm_run;
+static uint32_t mm_seed;
+static uint32_t mm_overhead;
+
+/* xorshift32, the same sequence on every build */
+static uint32_t mm_rand(void){
+    mm_seed ^= mm_seed << 13;
+    mm_seed ^= mm_seed >> 17;
+    mm_seed ^= mm_seed << 5;
+    return mm_seed;
+}
+
+static uint32_t mm_range(uint32_t lo, uint32_t hi){
+    return lo + mm_rand() % (hi - lo + 1);
+}
+
+/* Timing */
+
+#ifdef MMTEST_NATIVE
+
+static void mm_timer_init(void){
+}
+
+static inline uint32_t mm_now(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)ts.tv_sec * 1000000000u + (uint32_t)ts.tv_nsec;
+}
+
+static inline uint32_t mm_elapsed(uint32_t start, uint32_t end){
+    return end - start;
+}
+
+#else
+
+#define DWT_CTRL   (*(volatile uint32_t*)0xE0001000)
+#define DWT_CYCCNT (*(volatile uint32_t*)0xE0001004)
+#define DWT_CTRL_CYCCNTENA 1
+
+static int mm_dwt = 0;
+
+static void mm_timer_init(void){
+    uint32_t start;
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+    start = DWT_CYCCNT;
+    __asm__ volatile("nop\n\tnop\n\tnop\n\tnop");
+    mm_dwt = (DWT_CYCCNT != start);
+}
+
+/* SysTick counts down from LOAD once per tick, so its time only spans one
+ * tick, which is plenty for a single malloc */
+static inline uint32_t mm_now(void){
+    if(mm_dwt)
+        return DWT_CYCCNT;
+    return SysTick->LOAD - SysTick->VAL;
+}
 
-#define CIRCBUFSIZE 5000
-unsigned int write_pointer, read_pointer;
-static struct slot slots[CIRCBUFSIZE];
-static unsigned int lfsr = 0xACE1;
+static inline uint32_t mm_elapsed(uint32_t start, uint32_t end){
+    if(mm_dwt || (end >= start))
+        return end - start;
+    return end + SysTick->LOAD + 1 - start;
+}
 
+#endif
 
-static unsigned int circbuf_size(void)
-{
-    return (write_pointer + CIRCBUFSIZE - read_pointer) % CIRCBUFSIZE;
+static int mm_fls(uint32_t v){
+    return 31 - __builtin_clz(v);
 }
 
-static void write_cb(struct slot foo)
-{
-    if (circbuf_size() == CIRCBUFSIZE - 1) {
-        fio_printf(2, "\r\ncircular buffer overflow\r\n");
-        //exit(1);
+static void mm_hist_add(mm_hist_t* hist, uint32_t v){
+    int e, index;
+
+    v = (v > mm_overhead) ? v - mm_overhead : 0;
+    if(v < MM_SUB){
+        index = v;
+    }else{
+        e = mm_fls(v);
+        index = (e - MM_SUB_LOG2 + 1) * MM_SUB + ((v >> (e - MM_SUB_LOG2)) & (MM_SUB - 1));
     }
-    slots[write_pointer++] = foo;
-    write_pointer %= CIRCBUFSIZE;
+    hist->count[index]++;
+    hist->n++;
+    hist->sum += v;
+    if(v > hist->max)
+        hist->max = v;
 }
 
-static struct slot read_cb(void)
-{
-    struct slot foo;
-    if (write_pointer == read_pointer) {
-        // circular buffer is empty
-        return (struct slot){ .pointer=NULL, .size=0, .lfsr=0 };
+/* Upper bound of the bucket holding the pct-th percentile */
+static uint32_t mm_hist_pct(const mm_hist_t* hist, uint32_t pct){
+    uint32_t want = (hist->n * pct + 99) / 100;
+    uint32_t seen = 0, top;
+    int i, e;
+
+    for(i = 0; i < MM_BUCKETS; i++){
+        seen += hist->count[i];
+        if(seen && seen >= want)
+            break;
+    }
+    if(i < MM_SUB){
+        top = i;
+    }else{
+        e = i / MM_SUB + MM_SUB_LOG2 - 1;
+        top = (((uint32_t)(MM_SUB + i % MM_SUB + 1)) << (e - MM_SUB_LOG2)) - 1;
     }
-    foo = slots[read_pointer++];
-    read_pointer %= CIRCBUFSIZE;
-    return foo;
-}
-
-
-// Get a pseudorandom number generator from Wikipedia
-static int prng(void) __attribute__((naked));
-static int prng(void){
-
-    /*static unsigned int bit;
-    // taps: 16 14 13 11; characteristic polynomial: x^16 + x^14 + x^13 + x^11 + 1 
-    bit  = ((lfsr >> 0) ^ (lfsr >> 2) ^ (lfsr >> 3) ^ (lfsr >> 5) ) & 1;
-    lfsr =  (lfsr >> 1) | (bit << 15);*/
-    //return lfsr & 0xffff;
-   
-    /* ASM Impletation
-	movt r3, higer 16 bits of &lfsr
-	movw r3, lower 16 bits of &lfsr
-	;r3=*r3 == lfsr
-	ldr r3, [r3, #0]
-	;r2 = r3 >> 2
-	mov.w r2, r3, lsr #2
-
-	movt r3, higer 16 bits of &lfsr
-	movw r3, lower 16 bits of &lfsr
-	ldr r3, [r3, #0]
-	(lfsr >> 0) ^ (lfsr >> 2)
-	eors r2, r3
-	...
-    */
-
-
-    __asm__ (
-	"mov r0, %1\t\n" // r0 = lfsr
-	"eor r3, r3\t\n" // r3 = 0 
-	"eor r3, r0\t\n" // r3 ^= lfsr
-	"mov r2, r0, lsr #2\t\n"
-	"eor r3, r2\t\n" // r3 ^= lfsr>>2 
-	"mov r2, r0, lsr #3\t\n"
-	"eor r3, r2\t\n" // r3 ^= lfsr>>3 
-	"mov r2, r0, lsr #5\t\n"
-	"eor r3, r2\t\n" // r3 ^= lfsr>>5 
-	"and r3, #0x1\t\n" //bit = r3 & 1
-	"mov r3, r3, lsl #15\t\n" //r3=bit<<15
-	"mov r2, r0, lsr #1\t\n" // r2= lfsr>>1
-	"orr r2, r3\t\n"
-	"mov %0, r2\t\n"
-	"mov r0, r2, lsl #16\t\n" // r0 = lfsr(r2) & 0xFFFF
-	"mov r0, r0, lsr #16\t\n"
-    : "=r" (lfsr)
-    : "r" (lfsr)
-    : "r2", "r0");
-
-    __asm__("bx lr\t\n");
+    return (top < hist->max) ? top : hist->max;
+}
+
+/* Operations, only the allocator call itself is timed */
+
+static void mm_sample_heap(void){
+    xHeapStats stats;
+    uint32_t frag;
+
+    vPortGetHeapStats(&stats);
+    if(stats.xAvailableHeapSpaceInBytes < mm_run.min_free)
+        mm_run.min_free = stats.xAvailableHeapSpaceInBytes;
+    if(!stats.xAvailableHeapSpaceInBytes)
+        return;
+    frag = 100 - (uint32_t)((uint64_t)stats.xSizeOfLargestFreeBlockInBytes * 100 /
+                            stats.xAvailableHeapSpaceInBytes);
+    if(frag > mm_run.peak_frag)
+        mm_run.peak_frag = frag;
+}
+
+static int mm_alloc(int slot, uint32_t size){
+    mm_slot_t* s = &mm_run.slots[slot];
+    uint32_t start, end;
+    void* p;
 
+    vTaskSuspendAll();
+    start = mm_now();
+    p = pvPortMalloc(size);
+    end = mm_now();
+    xTaskResumeAll();
+
+    mm_hist_add(&mm_run.malloc_lat, mm_elapsed(start, end));
+    mm_run.ops++;
+    if(!p){
+        mm_run.failures++;
+        return -1;
+    }
+
+    s->ptr = p;
+    s->size = size;
+    s->tag = (uint8_t)mm_rand();
+    memset(s->ptr, s->tag, size);
+    mm_sample_heap();
     return 0;
 }
 
+static void mm_free(int slot){
+    mm_slot_t* s = &mm_run.slots[slot];
+    uint32_t start, end, i;
 
-void mmtest_command(int n, char *argv[]){
-    int i, size;
-    char *p;
-
-    fio_printf(2, "\r\n");
-    while (1) {
-        size = prng() & 0x7FF;
-        fio_printf(1, "try to allocate %d bytes\r\n", size);
-        p = (char *) pvPortMalloc(size);
-        fio_printf(1, "malloc returned 0x%x\r\n", p);
-        if (p == NULL) {
-            // can't do new allocations until we free some older ones
-            while (circbuf_size() > 0) {
-                // confirm that data didn't get trampled before freeing
-                struct slot foo = read_cb();
-                p = foo.pointer;
-                lfsr = foo.lfsr;  // reset the PRNG to its earlier state
-                size = foo.size;
-                fio_printf(1, "free a block, size %d\r\n", size);
-                for (i = 0; i < size; i++) {
-                    unsigned char u = p[i];
-                    unsigned char v = (unsigned char) prng();
-                    if (u != v) {
-                        fio_printf(1, "OUCH: u=%x, v=%x\r\n", u, v);
-                        return ;
-                    }
-                }
-                vPortFree(p);
-                if ((prng() & 1) == 0) break;
-            }
-        } else {
-            fio_printf(1, "allocate a block, size %d\r\n", size);
-            write_cb((struct slot){.pointer=p, .size=size, .lfsr=lfsr});
-            for (i = 0; i < size; i++) {
-                p[i] = (unsigned char) prng();
+    /* Anything else writing into the block is an allocator bug */
+    for(i = 0; i < s->size; i++){
+        if(s->ptr[i] != s->tag){
+            mm_run.corruptions++;
+            break;
+        }
+    }
+
+    vTaskSuspendAll();
+    start = mm_now();
+    vPortFree(s->ptr);
+    end = mm_now();
+    xTaskResumeAll();
+
+    mm_hist_add(&mm_run.free_lat, mm_elapsed(start, end));
+    mm_run.ops++;
+    s->ptr = NULL;
+    mm_sample_heap();
+}
+
+static void mm_free_all(void){
+    int i;
+
+    for(i = 0; i < MM_SLOTS; i++){
+        if(mm_run.slots[i].ptr)
+            mm_free(i);
+    }
+}
+
+/* Mostly small blocks with a tail of large ones */
+static uint32_t mm_mixed_size(void){
+    uint32_t r = mm_rand() % 100;
+
+    if(r < 75)
+        return mm_range(8, 128);
+    if(r < 95)
+        return mm_range(129, 1024);
+    return mm_range(1025, 2048);
+}
+
+/* Profiles, each runs until ops operations were done */
+
+static void mm_profile_random(uint32_t ops){
+    int slot;
+
+    while(mm_run.ops < ops){
+        slot = mm_rand() % MM_SLOTS;
+        if(mm_run.slots[slot].ptr)
+            mm_free(slot);
+        else
+            mm_alloc(slot, mm_mixed_size());
+    }
+}
+
+/* Same sized objects, like inodes or locks */
+static void mm_profile_small(uint32_t ops){
+    int slot;
+
+    while(mm_run.ops < ops){
+        slot = mm_rand() % MM_SLOTS;
+        if(mm_run.slots[slot].ptr)
+            mm_free(slot);
+        else
+            mm_alloc(slot, 24);
+    }
+}
+
+/* Messages are allocated at the tail of a queue and freed from its head in
+ * bursts, so blocks die in the order they were born */
+static void mm_profile_prodcons(uint32_t ops){
+    uint32_t head = 0, tail = 0, burst;
+
+    while(mm_run.ops < ops){
+        burst = mm_range(1, 16);
+        if(mm_rand() & 1){
+            while(burst-- && (tail - head < MM_SLOTS) && (mm_run.ops < ops)){
+                if(!mm_alloc(tail % MM_SLOTS, mm_range(16, 256)))
+                    tail++;
             }
+        }else{
+            while(burst-- && (head != tail) && (mm_run.ops < ops))
+                mm_free(head++ % MM_SLOTS);
+        }
+    }
+}
+
+/* Fill the heap with small and large blocks in turn, free the small ones
+ * and then ask for blocks larger than any hole that is left */
+static void mm_profile_torture(uint32_t ops){
+    int i;
+
+    while(mm_run.ops < ops){
+        for(i = 0; (i < MM_SLOTS) && (mm_run.ops < ops); i++){
+            if(mm_alloc(i, (i & 1) ? mm_range(256, 512) : mm_range(16, 32)))
+                break;
+        }
+        for(i = 0; (i < MM_SLOTS) && (mm_run.ops < ops); i += 2){
+            if(mm_run.slots[i].ptr)
+                mm_free(i);
+        }
+        for(i = 0; (i < MM_SLOTS) && (mm_run.ops < ops); i += 2)
+            mm_alloc(i, mm_range(512, 1024));
+        for(i = 0; (i < MM_SLOTS) && (mm_run.ops < ops); i++){
+            if(mm_run.slots[i].ptr)
+                mm_free(i);
         }
     }
+}
+
+typedef struct mm_profile_t{
+    const char* name;
+    void (*run)(uint32_t ops);
+}mm_profile_t;
 
+static const mm_profile_t mm_profiles[] = {
+    { "random", mm_profile_random },
+    { "small", mm_profile_small },
+    { "prodcons", mm_profile_prodcons },
+    { "torture", mm_profile_torture },
+};
+
+#define MM_PROFILE_COUNT (sizeof(mm_profiles) / sizeof(mm_profiles[0]))
+
+static void mm_report_lat(const char* name, const mm_hist_t* hist){
+    if(!hist->n)
+        return;
+    mm_printf("  %-6s " MM_UNIT ": mean %u p50 %u p90 %u p99 %u max %u" MM_NL,
+              name, (unsigned int)(hist->sum / hist->n),
+              (unsigned int)mm_hist_pct(hist, 50), (unsigned int)mm_hist_pct(hist, 90),
+              (unsigned int)mm_hist_pct(hist, 99), (unsigned int)hist->max);
+}
+
+static void mm_bench(const mm_profile_t* profile, uint32_t ops, uint32_t seed){
+    xHeapStats before, after;
+    uint32_t done;
+
+    memset(&mm_run, 0, sizeof(mm_run));
+    mm_seed = seed ? seed : MM_DEFAULT_SEED;
+    vPortGetHeapStats(&before);
+    mm_run.min_free = before.xAvailableHeapSpaceInBytes;
+
+    profile->run(ops);
+    done = mm_run.ops;
+    mm_free_all();
+    vPortGetHeapStats(&after);
+
+    mm_printf("%-8s ops %u, failed %u, peak frag %u%%, min free %u/%u" MM_NL,
+              profile->name, (unsigned int)done, (unsigned int)mm_run.failures,
+              (unsigned int)mm_run.peak_frag, (unsigned int)mm_run.min_free,
+              (unsigned int)before.xAvailableHeapSpaceInBytes);
+    mm_report_lat("malloc", &mm_run.malloc_lat);
+    mm_report_lat("free", &mm_run.free_lat);
+    if(mm_run.corruptions)
+        mm_printf("  %u blocks were corrupted!" MM_NL, (unsigned int)mm_run.corruptions);
+    if(after.xAvailableHeapSpaceInBytes != before.xAvailableHeapSpaceInBytes)
+        mm_printf("  free bytes %u before, %u after" MM_NL,
+                  (unsigned int)before.xAvailableHeapSpaceInBytes,
+                  (unsigned int)after.xAvailableHeapSpaceInBytes);
+}
+
+static uint32_t mm_atou(const char* s){
+    uint32_t v = 0;
+
+    for(; *s >= '0' && *s <= '9'; s++)
+        v = v * 10 + (*s - '0');
+    return v;
+}
+
+/* mmtest [profile|all] [ops] [seed] */
+void mmtest_command(int n, char *argv[]){
+    const char* name = (n > 1) ? argv[1] : "all";
+    uint32_t ops = (n > 2) ? mm_atou(argv[2]) : MM_DEFAULT_OPS;
+    uint32_t seed = (n > 3) ? mm_atou(argv[3]) : MM_DEFAULT_SEED;
+    uint32_t start, i, found = 0;
+
+    mm_printf(MM_NL);
+    mm_timer_init();
+
+    /* The heap sets itself up on the first malloc */
+    vPortFree(pvPortMalloc(1));
+
+    /* Cost of reading the timer, taken off every sample */
+    mm_overhead = 0xffffffff;
+    for(i = 0; i < 16; i++){
+        start = mm_now();
+        start = mm_elapsed(start, mm_now());
+        if(start < mm_overhead)
+            mm_overhead = start;
+    }
+
+    for(i = 0; i < MM_PROFILE_COUNT; i++){
+        if(strcmp(name, "all") && strcmp(name, mm_profiles[i].name))
+            continue;
+        mm_bench(&mm_profiles[i], ops, seed);
+        found++;
+    }
+
+    if(!found)
+        mm_printf("Usage: mmtest [random|small|prodcons|torture|all] [ops] [seed]" MM_NL);
+}
+
+#ifdef MMTEST_NATIVE
+int main(int argc, char *argv[]){
+    mmtest_command(argc, argv);
+    return 0;
 }
+#endif
@@ -0,0 +1,67 @@
+#include <FreeRTOS.h>
+#include <task.h>
+#include "pool.h"
+
+static pool_t* pool_list = NULL;
+
+void* pool_get(pool_t* pool){
+    uint32_t index;
+    void* object = NULL;
+
+    taskENTER_CRITICAL();
+    if(!pool->registered){
+        pool->registered = 1;
+        pool->next = pool_list;
+        pool_list = pool;
+    }
+
+    if(pool->free_count){
+        index = pool->free_stack[--pool->free_count];
+    }else if(pool->next_unused < pool->capacity){
+        index = pool->next_unused++;
+    }else{
+        pool->failures++;
+        taskEXIT_CRITICAL();
+        return NULL;
+    }
+
+    object = pool->objects + index * pool->object_size;
+    if(++pool->used > pool->high_water)
+        pool->high_water = pool->used;
+    taskEXIT_CRITICAL();
+
+    return object;
+}
+
+void pool_put(pool_t* pool, void* object){
+    uint32_t index;
+
+    if(!object)
+        return;
+
+    index = ((uint8_t*)object - pool->objects) / pool->object_size;
+
+    taskENTER_CRITICAL();
+    pool->free_stack[pool->free_count++] = index;
+    pool->used--;
+    taskEXIT_CRITICAL();
+}
+
+int pool_stat(int index, pool_stat_t* stat){
+    pool_t* pool;
+
+    taskENTER_CRITICAL();
+    for(pool = pool_list; pool && index; pool = pool->next)
+        index--;
+    if(pool){
+        stat->name = pool->name;
+        stat->object_size = pool->object_size;
+        stat->capacity = pool->capacity;
+        stat->used = pool->used;
+        stat->high_water = pool->high_water;
+        stat->failures = pool->failures;
+    }
+    taskEXIT_CRITICAL();
+
+    return pool ? 0 : -1;
+}
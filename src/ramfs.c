@@ -7,6 +7,7 @@
 #include "ramfs.h"
 #include "osdebug.h"
 #include "hash-djb2.h"
+#include "pool.h"
 
 #include "clib.h"
 
@@ -23,191 +24,407 @@ static uint32_t device_count = 0xAAAA; //A magic Number
 
 ramfs_superblock_t* ramfs_sb_list = NULL;
 
-static ramfs_superblock_t* init_superblock(void){
-    ramfs_superblock_t* ret = (ramfs_superblock_t*)calloc(sizeof(ramfs_superblock_t), 1);
+POOL_DEFINE(ramfs_sb_pool, ramfs_superblock_t, MAX_RAMFS_MOUNTS)
+
+/* Chunked slab allocator. Objects are addressed by index so block and inode
+ * numbers stay valid while the slab grows. Chunks are never moved, only the
+ * small chunk table is reallocated, and freed objects are kept on a free
+ * list threaded through their first word. */
+static void slab_init(ramfs_slab_t* slab, uint32_t object_size, uint32_t chunk_bytes){
+    slab->object_size = object_size < sizeof(uint32_t) ? sizeof(uint32_t) : object_size;
+    slab->chunk_shift = 0;
+    while((slab->object_size << (slab->chunk_shift + 1)) <= chunk_bytes)
+        slab->chunk_shift++;
+    slab->chunk_count = 0;
+    slab->chunk_capacity = 0;
+    slab->chunks = NULL;
+    slab->next_unused = 0;
+    slab->free_head = RAMFS_SLAB_NONE;
+    slab->used = 0;
+}
+
+static void* slab_ptr(const ramfs_slab_t* slab, uint32_t index){
+    return slab->chunks[index >> slab->chunk_shift] + \
+        (index & ((1U << slab->chunk_shift) - 1)) * slab->object_size;
+}
+
+static int32_t slab_alloc(ramfs_slab_t* slab){
+    uint32_t index;
+
+    if(slab->free_head != RAMFS_SLAB_NONE){
+        index = slab->free_head;
+        slab->free_head = *(uint32_t*)slab_ptr(slab, index);
+        slab->used++;
+        return index;
+    }
+
+    if(slab->next_unused >= (slab->chunk_count << slab->chunk_shift)){
+        if(slab->chunk_count >= slab->chunk_capacity){
+            uint32_t capacity = slab->chunk_capacity ? slab->chunk_capacity * 2 : 4;
+            uint8_t** table = (uint8_t**)calloc(sizeof(uint8_t*), capacity);
+            if(!table)
+                return -1;
+            memcpy(table, slab->chunks, sizeof(uint8_t*) * slab->chunk_count);
+            free(slab->chunks);
+            slab->chunks = table;
+            slab->chunk_capacity = capacity;
+        }
+        slab->chunks[slab->chunk_count] = (uint8_t*)malloc(slab->object_size << slab->chunk_shift);
+        if(!slab->chunks[slab->chunk_count])
+            return -1;
+        slab->chunk_count++;
+    }
+
+    slab->used++;
+    return slab->next_unused++;
+}
+
+static void slab_free(ramfs_slab_t* slab, uint32_t index){
+    *(uint32_t*)slab_ptr(slab, index) = slab->free_head;
+    slab->free_head = index;
+    slab->used--;
+}
+
+static ramfs_superblock_t* init_superblock(uint32_t block_size){
+    ramfs_superblock_t* ret = ramfs_sb_pool_get();
+    if(!ret)
+        return NULL;
+    /* A reused slot still holds the previous mount */
+    memset(ret, 0, sizeof(ramfs_superblock_t));
     ret->device = device_count++;
-    ret->inode_count = 0; 
-    ret->block_count = 0;
-    ret->inode_list = NULL;
+    ret->block_size = block_size;
+    ret->block_shift = 0;
+    while((1U << ret->block_shift) < block_size)
+        ret->block_shift++;
+    slab_init(&ret->inodes, sizeof(ramfs_inode_t), RAMFS_SLAB_CHUNK_SIZE);
+    slab_init(&ret->blocks, block_size, RAMFS_SLAB_CHUNK_SIZE);
     ret->next = ramfs_sb_list;
     ramfs_sb_list = ret;
     return ret;
 }
 
+/* Only for a superblock that never got mounted, it is still the list head */
+static void release_superblock(ramfs_superblock_t* sb){
+    for(uint32_t i = 0; i < sb->inodes.chunk_count; i++)
+        free(sb->inodes.chunks[i]);
+    free(sb->inodes.chunks);
+    for(uint32_t i = 0; i < sb->blocks.chunk_count; i++)
+        free(sb->blocks.chunks[i]);
+    free(sb->blocks.chunks);
+    ramfs_sb_list = sb->next;
+    ramfs_sb_pool_put(sb);
+}
 
-/*
-static void deinit_superblock(ramfs_superblock_t* sb){
-    if(!sb->inode_list)
-        free(sb->inode_list);
-    free(sb);
+static ramfs_inode_t* get_inode(const ramfs_superblock_t* sb, uint32_t number){
+    return (ramfs_inode_t*)slab_ptr(&sb->inodes, number);
+}
+
+static uint8_t* get_block(const ramfs_superblock_t* sb, uint32_t number){
+    return (uint8_t*)slab_ptr(&sb->blocks, number);
 }
-*/
 
 static ramfs_inode_t* add_inode(const char* filename, ramfs_superblock_t* sb){
-    ramfs_inode_t* ret = (ramfs_inode_t*)calloc(sizeof(ramfs_inode_t), 1);
-    if(!ret)
+    int32_t number = slab_alloc(&sb->inodes);
+    if(number < 0)
         return NULL;
+    ramfs_inode_t* ret = get_inode(sb, number);
+    memset(ret, 0, sizeof(ramfs_inode_t));
     ret->hash = hash_djb2((uint8_t*)filename, -1);
     ret->device = sb->device;
     strcpy(ret->filename, filename);
     ret->attribute = 0;
     ret->data_length = 0;
     ret->block_count = 0;
-    ret->number = sb->inode_count;
+    ret->block_capacity = 0;
+    ret->blocks = NULL;
+    ret->index_size = 0;
+    ret->index = NULL;
+    ret->number = number;
+    ret->sb = sb;
+    return ret;
+}
 
-    ramfs_inode_t** src = sb->inode_list;
-    sb->inode_list = (ramfs_inode_t**)calloc(sizeof(ramfs_inode_t*), sb->inode_count + 1);
-    memcpy(sb->inode_list, src, sizeof(ramfs_inode_t*) * sb->inode_count);
-    free(src);
+/* Blocks come back from the slab with old contents and the free list link,
+ * a file must never see either */
+static int32_t add_block(ramfs_superblock_t* sb){
+    int32_t block = slab_alloc(&sb->blocks);
+    if(block >= 0)
+        memset(get_block(sb, block), 0, sb->block_size);
+    return block;
+}
 
-    sb->inode_list[sb->inode_count++] = ret;
-    return ret;
+/* Zeroes [from, to) of a file, as far as it has blocks for it */
+static void zero_range(ramfs_inode_t* node, uint32_t from, uint32_t to){
+    ramfs_superblock_t* sb = node->sb;
+    uint32_t block_number = from >> sb->block_shift;
+    uint32_t block_offset = from & (sb->block_size - 1);
+    uint32_t len;
+
+    while((from < to) && (block_number < node->block_count)){
+        len = sb->block_size - block_offset;
+        if(len > to - from)
+            len = to - from;
+        memset(get_block(sb, node->blocks[block_number++]) + block_offset, 0, len);
+        from += len;
+        block_offset = 0;
+    }
+}
+
+/* Append an entry to the indirect block table of an inode, the table grows
+ * geometrically so appending is amortized O(1) */
+static int inode_append_block(ramfs_inode_t* node, uint32_t entry){
+    if(node->block_count >= node->block_capacity){
+        uint32_t capacity = node->block_capacity ? node->block_capacity * 2 : RAMFS_INITIAL_BLOCK_TABLE;
+        uint32_t* table = (uint32_t*)calloc(sizeof(uint32_t), capacity);
+        if(!table)
+            return -1;
+        memcpy(table, node->blocks, sizeof(uint32_t) * node->block_count);
+        free(node->blocks);
+        node->blocks = table;
+        node->block_capacity = capacity;
+    }
+    node->blocks[node->block_count++] = entry;
+    return 0;
+}
+
+/* A directory keeps its children's inode numbers in blocks[] in creation
+ * order, which is what readdir walks. index[] is an open addressing table
+ * over blocks[] keyed by the child's name hash, slots hold position + 1. */
+static int name_equal(const char* filename, const char* name, uint32_t len){
+    for(uint32_t i = 0; i < len; i++){
+        if(filename[i] != name[i])
+            return 0;
+    }
+    return filename[len] == '\0';
 }
 
-static uint32_t add_block(ramfs_superblock_t* sb){
-    ramfs_block_t* ret = (ramfs_block_t*)calloc(sizeof(ramfs_block_t), 1);
+static int32_t dir_find(ramfs_inode_t* dir, const char* name, uint32_t len, uint32_t hash){
+    ramfs_inode_t* child;
+    uint32_t slot;
 
-    ramfs_block_t** src = sb->block_pool;
-    sb->block_pool = (ramfs_block_t**)calloc(sizeof(ramfs_block_t*), sb->block_count + 1);
-    memcpy(sb->block_pool, src, sizeof(ramfs_block_t*) * sb->block_count);
-    free(src);
+    if(!dir->index_size)
+        return -1;
 
-    sb->block_pool[sb->block_count++] = ret;
-    return sb->block_count - 1;
+    for(slot = hash & (dir->index_size - 1); dir->index[slot]; slot = (slot + 1) & (dir->index_size - 1)){
+        child = get_inode(dir->sb, dir->blocks[dir->index[slot] - 1]);
+        if((child->hash == hash) && name_equal(child->filename, name, len))
+            return child->number;
+    }
+    return -1;
 }
 
-static ssize_t ramfs_write(struct inode_t* inode, const void* buf, size_t count, off_t offset) {
-    ramfs_superblock_t* ptr = ramfs_sb_list;
-    ramfs_inode_t * ramfs_node = NULL;
+static int dir_index_resize(ramfs_inode_t* dir, uint32_t size){
+    uint32_t* index = (uint32_t*)calloc(sizeof(uint32_t), size);
+    uint32_t slot;
 
-    while(ptr){
-        if(ptr->device == inode->device){
-            if(inode->number >= ptr->inode_count)
-               return -1;
+    if(!index)
+        return -1;
 
-            ramfs_node = ptr->inode_list[inode->number];
-            break;
-        }
-        ptr = ptr->next;
+    for(uint32_t i = 0; i < dir->block_count; i++){
+        slot = get_inode(dir->sb, dir->blocks[i])->hash & (size - 1);
+        while(index[slot])
+            slot = (slot + 1) & (size - 1);
+        index[slot] = i + 1;
     }
 
-    if(!ramfs_node)
+    free(dir->index);
+    dir->index = index;
+    dir->index_size = size;
+    return 0;
+}
+
+static int dir_add(ramfs_inode_t* dir, ramfs_inode_t* child){
+    uint32_t slot;
+
+    /* Keep the load factor at or below 1/2 */
+    if((dir->block_count + 1) * 2 > dir->index_size){
+        if(dir_index_resize(dir, dir->index_size ? dir->index_size * 2 : RAMFS_INITIAL_DIR_INDEX))
+            return -1;
+    }
+    if(inode_append_block(dir, child->number))
         return -1;
+
+    slot = child->hash & (dir->index_size - 1);
+    while(dir->index[slot])
+        slot = (slot + 1) & (dir->index_size - 1);
+    dir->index[slot] = dir->block_count;
+    return 0;
+}
+
+/* Blocks are filled straight from the segments, a segment boundary does
+ * not start a new block */
+static ssize_t ramfs_writev(struct inode_t* inode, const fio_iovec_t* iov, int iovcnt, off_t offset) {
+    ramfs_inode_t * ramfs_node = (ramfs_inode_t*)inode->opaque;
+    ramfs_superblock_t* ptr = ramfs_node->sb;
     if(ramfs_node->attribute && 1)
         return -2;
 
-    uint8_t* src = (uint8_t*)buf;
-    uint32_t start_block_number;
-    uint32_t pCount = count;     
-
-    if(!count)
-        return 0;
+    uint32_t block_number = offset >> ptr->block_shift;
+    uint32_t block_offset = offset & (ptr->block_size - 1);
+    uint32_t pCount = 0, count = 0, seg_offset = 0;
+    uint32_t room, len;
+    uint8_t* dst;
+    int seg = 0;
+
+    for(int i = 0; i < iovcnt; i++)
+        count += iov[i].len;
+
+    /* A hole left by writing past the end reads back as zeros */
+    if(count && (offset > ramfs_node->data_length))
+        zero_range(ramfs_node, ramfs_node->data_length, offset);
+
+    while(pCount < count){
+        while(block_number >= ramfs_node->block_count){
+            int32_t block = add_block(ptr);
+            if(block < 0)
+                break;
+            if(inode_append_block(ramfs_node, block)){
+                slab_free(&ptr->blocks, block);
+                break;
+            }
+        }
+        if(block_number >= ramfs_node->block_count)
+            break;
 
-    start_block_number = offset >> 6;   //Every Block is 4096 Bytes
-    
-    if(start_block_number >= ramfs_node->block_count){
-        ramfs_node->blocks[ramfs_node->block_count] = add_block(ptr);
-        ramfs_node->block_count++;
-    }
-    memcpy(ptr->block_pool[ramfs_node->blocks[start_block_number++]]->data + (offset & (0x3F)), src, \
-            count < (BLOCK_SIZE - (offset & (0x3F))) ? count : BLOCK_SIZE - (offset & (0x3F)));
-    src += count < (BLOCK_SIZE - (offset & (0x3F))) ? count : BLOCK_SIZE - (offset & (0x3F));
-    count -= count < (BLOCK_SIZE - (offset & (0x3F))) ? count : BLOCK_SIZE - (offset & (0x3F));
-
-    while(count){
-        if(start_block_number >= ramfs_node->block_count){
-            ramfs_node->blocks[ramfs_node->block_count] = add_block(ptr);
-            ramfs_node->block_count++;
+        dst = get_block(ptr, ramfs_node->blocks[block_number++]) + block_offset;
+        room = ptr->block_size - block_offset;
+        while(room && (seg < iovcnt)){
+            len = iov[seg].len - seg_offset;
+            if(len > room)
+                len = room;
+            memcpy(dst, (const uint8_t*)iov[seg].base + seg_offset, len);
+            dst += len;
+            room -= len;
+            pCount += len;
+            seg_offset += len;
+            if(seg_offset == iov[seg].len){
+                seg++;
+                seg_offset = 0;
+            }
         }
-        memcpy(ptr->block_pool[ramfs_node->blocks[start_block_number++]]->data, src, (count > BLOCK_SIZE ? BLOCK_SIZE: count));
-        src += (count > BLOCK_SIZE ? BLOCK_SIZE: count);
-        count -= (count > BLOCK_SIZE ? BLOCK_SIZE: count);
+        block_offset = 0;
     }
 
+    if(!pCount && count)
+        return -3;
+
     offset += pCount;
     if(offset > ramfs_node->data_length)
-        ramfs_node->data_length += offset - ramfs_node->data_length;
+        ramfs_node->data_length = offset;
 
     return pCount;
 }
 
-static ssize_t ramfs_read(struct inode_t* inode, void* buf, size_t count, off_t offset) {
-    ramfs_superblock_t* ptr = ramfs_sb_list; 
-    ramfs_inode_t * ramfs_node = NULL;
-
-    while(ptr){
-        if(ptr->device == inode->device){
-            if(inode->number >= ptr->inode_count)
-               return -1;
-
-            ramfs_node = ptr->inode_list[inode->number];
-            break;
-        }
-        ptr = ptr->next;
-    }
+static ssize_t ramfs_write(struct inode_t* inode, const void* buf, size_t count, off_t offset) {
+    fio_iovec_t iov = { (void*)buf, count };
+    return ramfs_writev(inode, &iov, 1, offset);
+}
 
-    if(!ramfs_node)
-        return -1;
+static ssize_t ramfs_readv(struct inode_t* inode, const fio_iovec_t* iov, int iovcnt, off_t offset) {
+    ramfs_inode_t * ramfs_node = (ramfs_inode_t*)inode->opaque;
+    ramfs_superblock_t* ptr = ramfs_node->sb;
     if(ramfs_node->attribute && 1)
         return -2;
 
-    uint8_t* des = (uint8_t*)buf;
     uint32_t size = ramfs_node->data_length;
-    uint32_t start_block_number;
-    
-    if(!count)
+    uint32_t block_number = offset >> ptr->block_shift;
+    uint32_t block_offset = offset & (ptr->block_size - 1);
+    uint32_t pCount = 0, count = 0, seg_offset = 0;
+    uint32_t room, len;
+    const uint8_t* src;
+    int seg = 0;
+
+    if((offset < 0) || (offset >= size))
         return 0;
 
-    if ((offset + count) > size)
+    for(int i = 0; i < iovcnt; i++)
+        count += iov[i].len;
+    if((offset + count) > size)
         count = size - offset;
 
-    uint32_t pCount = count;
-
-    start_block_number = offset >> 6;   //Every Block is 4096 Bytes
-    
-    memcpy(des, ptr->block_pool[ramfs_node->blocks[start_block_number++]]->data + (offset & (0x3F)), \
-            count < (BLOCK_SIZE - (offset & (0x3F))) ? count : BLOCK_SIZE - (offset & (0x3F)));
-    des += count < (BLOCK_SIZE - (offset & (0x3F))) ? count : BLOCK_SIZE - (offset & (0x3F));
-    count -= count < (BLOCK_SIZE - (offset & (0x3F))) ? count : BLOCK_SIZE - (offset & (0x3F));
-
-    while(count){
-        memcpy(des, ptr->block_pool[ramfs_node->blocks[start_block_number++]]->data, (count > BLOCK_SIZE ? BLOCK_SIZE: count));
-        des += (count > BLOCK_SIZE ? BLOCK_SIZE: count);
-        count -= (count > BLOCK_SIZE ? BLOCK_SIZE: count);
+    while(pCount < count){
+        src = get_block(ptr, ramfs_node->blocks[block_number++]) + block_offset;
+        room = ptr->block_size - block_offset;
+        if(room > count - pCount)
+            room = count - pCount;
+        while(room && (seg < iovcnt)){
+            len = iov[seg].len - seg_offset;
+            if(len > room)
+                len = room;
+            memcpy((uint8_t*)iov[seg].base + seg_offset, src, len);
+            src += len;
+            room -= len;
+            pCount += len;
+            seg_offset += len;
+            if(seg_offset == iov[seg].len){
+                seg++;
+                seg_offset = 0;
+            }
+        }
+        block_offset = 0;
     }
 
     return pCount;
 }
 
-static ssize_t ramfs_readdir(struct inode_t* inode, dir_entity_t* ent, off_t offset) {
-    ramfs_superblock_t* ptr = ramfs_sb_list; 
-    ramfs_inode_t * ramfs_node = NULL;
+static ssize_t ramfs_read(struct inode_t* inode, void* buf, size_t count, off_t offset) {
+    fio_iovec_t iov = { buf, count };
+    return ramfs_readv(inode, &iov, 1, offset);
+}
 
-    while(ptr){
-        if(ptr->device == inode->device){
-            if(inode->number >= ptr->inode_count)
-               return -1;
+/* Spans never cross a block, the caller falls back to a copy for that */
+static ssize_t ramfs_map(struct inode_t* inode, const void** ptr, size_t count, off_t offset) {
+    ramfs_inode_t * ramfs_node = (ramfs_inode_t*)inode->opaque;
+    ramfs_superblock_t* sb = ramfs_node->sb;
+    uint32_t block_offset = offset & (sb->block_size - 1);
+    uint32_t len;
 
-            ramfs_node = ptr->inode_list[inode->number];
-            break;
-        }
-        ptr = ptr->next;
-    }
+    if(ramfs_node->attribute & 1)
+        return -2;
+    if((offset < 0) || (offset >= ramfs_node->data_length))
+        return 0;
+
+    len = sb->block_size - block_offset;
+    if(len > ramfs_node->data_length - offset)
+        len = ramfs_node->data_length - offset;
+    if(len > count)
+        len = count;
+
+    *ptr = get_block(sb, ramfs_node->blocks[offset >> sb->block_shift]) + block_offset;
+    return len;
+}
+
+/* Only shrinking is supported, released blocks go back to the slab */
+static int ramfs_truncate(struct inode_t* inode, off_t length) {
+    ramfs_inode_t * ramfs_node = (ramfs_inode_t*)inode->opaque;
+    ramfs_superblock_t* ptr = ramfs_node->sb;
+    uint32_t keep;
 
-    if(!ramfs_node)
+    if(ramfs_node->attribute && 1)
+        return -2;
+    if((length < 0) || (length > ramfs_node->data_length))
         return -1;
 
-    if(offset >= ramfs_node->block_count)
+    keep = (length + ptr->block_size - 1) >> ptr->block_shift;
+    while(ramfs_node->block_count > keep)
+        slab_free(&ptr->blocks, ramfs_node->blocks[--ramfs_node->block_count]);
+    /* So growing the file again reads zeros after the new end */
+    zero_range(ramfs_node, length, keep << ptr->block_shift);
+    ramfs_node->data_length = length;
+
+    return 0;
+}
+
+static ssize_t ramfs_readdir(struct inode_t* inode, dir_entity_t* ent, off_t offset) {
+    ramfs_inode_t * ramfs_node = (ramfs_inode_t*)inode->opaque;
+    ramfs_inode_t * subfile_node;
+
+    if(!(ramfs_node->attribute & 1))
+        return -1;
+    if((offset < 0) || (offset >= ramfs_node->block_count))
         return -2;
 
-    ramfs_inode_t * subfile_node = NULL;
-    
-    for(uint32_t i = 0; i < ptr->inode_count; i++){
-        if(ptr->inode_list[i]->hash == ramfs_node->blocks[offset]){
-            subfile_node = ptr->inode_list[i];
-            break;
-        }
-    }
+    subfile_node = get_inode(ramfs_node->sb, ramfs_node->blocks[offset]);
 
     strcpy(ent->d_name, subfile_node->filename);
     ent->d_attr = subfile_node->attribute;
@@ -217,22 +434,7 @@ static ssize_t ramfs_readdir(struct inode_t* inode, dir_entity_t* ent, off_t off
 
 
 off_t ramfs_seek(struct inode_t* node, off_t offset) {
-    ramfs_superblock_t* ptr = ramfs_sb_list; 
-    ramfs_inode_t * ramfs_node = NULL;
-
-    while(ptr){
-        if(ptr->device == node->device){
-            if(node->number >= ptr->inode_count)
-               return -1;
-
-            ramfs_node = ptr->inode_list[node->number];
-            break;
-        }
-        ptr = ptr->next;
-    }
-
-    if(!ramfs_node)
-        return -1;
+    ramfs_inode_t * ramfs_node = (ramfs_inode_t*)node->opaque;
 
     uint32_t size;
     if(ramfs_node->attribute && 1)
@@ -318,89 +520,63 @@ static int ramfs_opendir(void * opaque, char * path) {
 }
 */
 
-int ramfs_i_create(struct inode_t* inode, const char* fn){
-    ramfs_inode_t* p_inode,* c_inode; 
-    ramfs_superblock_t* ptr = ramfs_sb_list;
-    while(ptr){
-        if(ptr->device == inode->device){
-            if(inode->number >= ptr->inode_count)
-               return -1;
-
-            p_inode = ptr->inode_list[inode->number];
-            if(!(p_inode->attribute & 1))
-                return -2;
+static int ramfs_add_child(struct inode_t* inode, const char* fn, uint32_t attribute){
+    ramfs_inode_t* p_inode = (ramfs_inode_t*)inode->opaque;
+    ramfs_inode_t* c_inode;
+    size_t len = strlen(fn);
 
-            c_inode = add_inode(fn, ptr);
-            p_inode->blocks[p_inode->block_count++] = c_inode->hash;
-            return 0;
-        }
-        ptr = ptr->next;
+    if(!(p_inode->attribute & 1))
+        return -2;
+    /* add_inode copies the name into filename, terminator included */
+    if(len >= sizeof(p_inode->filename))
+        return -5;
+    if(dir_find(p_inode, fn, len, hash_djb2((const uint8_t*)fn, -1)) >= 0)
+        return -4;
+
+    c_inode = add_inode(fn, p_inode->sb);
+    if(!c_inode)
+        return -3;
+    c_inode->attribute |= attribute;
+    if(dir_add(p_inode, c_inode)){
+        slab_free(&p_inode->sb->inodes, c_inode->number);
+        return -3;
     }
-    return -4;
+    return 0;
 }
 
-int ramfs_i_mkdir(struct inode_t* inode, const char* fn){
-    ramfs_inode_t* p_inode,* c_inode; 
-    ramfs_superblock_t* ptr = ramfs_sb_list;
-    while(ptr){
-        if(ptr->device == inode->device){
-            if(inode->number >= ptr->inode_count)
-               return -1;
-
-            p_inode = ptr->inode_list[inode->number];
-            if(!(p_inode->attribute & 1))
-                return -2;
+int ramfs_i_create(struct inode_t* inode, const char* fn){
+    return ramfs_add_child(inode, fn, 0);
+}
 
-            c_inode = add_inode(fn, ptr);
-            c_inode->attribute |= 1; //Set as Floder
-            p_inode->blocks[p_inode->block_count++] = c_inode->hash;
-            return 0;
-        }
-        ptr = ptr->next;
-    }
-    return -4;
+int ramfs_i_mkdir(struct inode_t* inode, const char* fn){
+    return ramfs_add_child(inode, fn, 1); //Set as Floder
 }
+
 int ramfs_i_lookup(struct inode_t* inode, const char* path){
     const char* slash = strchr(path, '/');
-    uint32_t hash = hash_djb2((uint8_t*)path, (slash == NULL ? -1 : (slash - path)));
+    uint32_t len = (slash == NULL) ? strlen(path) : (uint32_t)(slash - path);
+    uint32_t hash = hash_djb2((uint8_t*)path, len);
+    ramfs_inode_t* ramfs_inode = (ramfs_inode_t*)inode->opaque;
+    int32_t ret;
 
-    ramfs_inode_t* ramfs_inode; 
-    ramfs_superblock_t* ptr = ramfs_sb_list;
-    while(ptr){
-        if(ptr->device == inode->device){
-            if(inode->number >= ptr->inode_count)
-               return -1;
+    if(!(ramfs_inode->attribute & 1))
+        return -2;
 
-            ramfs_inode = ptr->inode_list[inode->number];
-            if(!(ramfs_inode->attribute & 1))
-                return -2;
-            for(uint32_t i = 0; i < ramfs_inode->block_count; i++){
-                if(!(ramfs_inode->attribute && 1))
-                    return -1;
-                if(ramfs_inode->blocks[i] == hash){
-                    for(uint32_t j = 0; j < ptr->inode_count; j++){
-                        if(ptr->inode_list[j]->hash == hash){
-                            return j; 
-                        }
-                    }
-               }
-            }
-            return -3;
-        }
-        ptr = ptr->next;
-    }
-    return -4;
+    ret = dir_find(ramfs_inode, path, len, hash);
+    return (ret < 0) ? -3 : ret;
 }
 
+/* The only place a device number is resolved to a superblock, every other
+ * entry point gets its ramfs inode from inode->opaque */
 int ramfs_read_inode(inode_t* inode){
     ramfs_superblock_t* ptr = ramfs_sb_list;
     while(ptr){
         if(ptr->device == inode->device){
-            if(inode->number >= ptr->inode_count)
+            if(inode->number >= ptr->inodes.next_unused)
                return -1;
-            //inode->size = ptr->inode_list[inode->number]->data_length;
-            inode->mode = ptr->inode_list[inode->number]->attribute;
-            inode->block_size = BLOCK_SIZE;
+            //inode->size = get_inode(ptr, inode->number)->data_length;
+            inode->mode = get_inode(ptr, inode->number)->attribute;
+            inode->block_size = ptr->block_size;
             inode->inode_ops.i_lookup = ramfs_i_lookup;
             inode->inode_ops.i_create = ramfs_i_create;
             inode->inode_ops.i_mkdir = ramfs_i_mkdir;
@@ -408,6 +584,11 @@ int ramfs_read_inode(inode_t* inode){
             inode->file_ops.read = ramfs_read;
             inode->file_ops.write = ramfs_write;
             inode->file_ops.readdir = ramfs_readdir;
+            inode->file_ops.truncate = ramfs_truncate;
+            inode->file_ops.map = ramfs_map;
+            inode->file_ops.readv = ramfs_readv;
+            inode->file_ops.writev = ramfs_writev;
+            inode->opaque = get_inode(ptr, inode->number);
 
             return 0;
         }
@@ -417,20 +598,31 @@ int ramfs_read_inode(inode_t* inode){
     return -2;
 }
 
+/* opaque may point to a ramfs_mount_opt_t, NULL selects the defaults */
 int ramfs_read_superblock(void* opaque, struct superblock_t* sb){
-    ramfs_superblock_t* ramfs_sb = init_superblock();
+    ramfs_mount_opt_t* opt = (ramfs_mount_opt_t*)opaque;
+    uint32_t block_size = RAMFS_DEFAULT_BLOCK_SIZE;
+    ramfs_superblock_t* ramfs_sb;
     ramfs_inode_t* ramfs_in;
+
+    if(opt && opt->block_size)
+        block_size = opt->block_size;
+    if((block_size < RAMFS_MIN_BLOCK_SIZE) || (block_size & (block_size - 1)))
+        return -2;
+
+    ramfs_sb = init_superblock(block_size);
     if(ramfs_sb){
         ramfs_in = add_inode("", ramfs_sb);
-        ramfs_in->attribute = 1;
         if(ramfs_in){
+            ramfs_in->attribute = 1;
             sb->device = ramfs_sb->device;
             sb->mounted = ramfs_in->number;
-            sb->block_size = BLOCK_SIZE;
+            sb->block_size = ramfs_sb->block_size;
             sb->type_hash = RAMFS_TYPE;
             sb->superblock_ops.s_read_inode = ramfs_read_inode;
             return 0;
         }
+        release_superblock(ramfs_sb);
     }
 
     return -1;
@@ -0,0 +1,302 @@
+#include <string.h>
+#include <stddef.h>
+#include <FreeRTOS.h>
+#include <semphr.h>
+#include <unistd.h>
+#include "fio.h"
+#include "filesystem.h"
+#include "romfs.h"
+#include "osdebug.h"
+#include "hash-djb2.h"
+
+#include "clib.h"
+
+/* Image layout, see tool/mkromfs.c:
+ *   struct romfs_header_t
+ *   uint32_t index[count][2]             (hash, record) sorted by hash
+ *   struct romfs_file_t table[count]     (record 0 is the root directory)
+ *   data, each record owns filename_length bytes of name followed by
+ *   length bytes of content. A directory's content is a uint32_t child
+ *   count followed by the child hashes.
+ *
+ * Hashes are djb2 over the path from the root, directories end in '/'.
+ * Inode numbers are record indices. Nothing is ever copied out of the
+ * image except into the caller's buffer. */
+#define ROMFS_MAGIC 0x464D4F52 /* "ROMF" */
+#define ROMFS_VERSION 2
+
+struct romfs_header_t{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t table_offset;
+    uint32_t data_offset;
+};
+
+struct romfs_file_t{
+    uint32_t hash;
+    uint32_t filename_length;
+    uint8_t attribute;
+    uint32_t length;
+    uint32_t data_offset;
+}__attribute__((packed));
+
+typedef struct romfs_mount_t{
+    uint32_t device;
+    const uint8_t* image;
+    const uint8_t* index;
+    const struct romfs_file_t* table;
+    const uint8_t* data;
+    uint32_t count;
+}romfs_mount_t;
+
+static uint32_t device_count = 0xBBBB; //A magic Number
+static romfs_mount_t romfs_mounts[MAX_ROMFS_MOUNTS];
+
+/* Directory data in the image is not aligned */
+static uint32_t get_unaligned(const uint8_t * d) {
+    return ((uint32_t) d[0]) | ((uint32_t) (d[1] << 8)) | ((uint32_t) (d[2] << 16)) | ((uint32_t) (d[3] << 24));
+}
+
+static const uint8_t* get_data_address(const romfs_mount_t* mount, const struct romfs_file_t* file){
+    return mount->data + file->data_offset;
+}
+
+static const uint8_t* get_content_address(const romfs_mount_t* mount, const struct romfs_file_t* file){
+    return get_data_address(mount, file) + file->filename_length;
+}
+
+/* Lower bound over the sorted index, records with the same hash follow */
+static uint32_t index_lower_bound(const uint8_t* index, uint32_t count, uint32_t h){
+    uint32_t lo = 0, hi = count, mid;
+
+    while(lo < hi){
+        mid = lo + (hi - lo) / 2;
+        if(get_unaligned(index + mid * 8) < h)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* First record with hash h, for callers that have nothing but the hash */
+static int32_t index_lookup(const uint8_t* index, uint32_t count, uint32_t h){
+    uint32_t i = index_lower_bound(index, count, h);
+
+    if((i < count) && (get_unaligned(index + i * 8) == h))
+        return get_unaligned(index + i * 8 + 4);
+    return -1;
+}
+
+/* The record of the component name in the directory whose full path hashes
+ * to h. The name and the kind are checked against the image. A step of
+ * djb2 is invertible, so equal path hashes with equal names also mean equal
+ * parent hashes, which is as far as the image lets the parent be checked. */
+static int32_t index_find(const romfs_mount_t* mount, uint32_t h, const char* name, uint32_t len, uint8_t dir){
+    const struct romfs_file_t* file;
+    uint32_t i, record;
+
+    for(i = index_lower_bound(mount->index, mount->count, h);
+        (i < mount->count) && (get_unaligned(mount->index + i * 8) == h); i++){
+        record = get_unaligned(mount->index + i * 8 + 4);
+        file = mount->table + record;
+        if((file->filename_length == len) && ((file->attribute & 1) == dir) &&
+           !memcmp(get_data_address(mount, file), name, len))
+            return record;
+    }
+    return -1;
+}
+
+static int header_valid(const uint8_t* romfs){
+    return (get_unaligned(romfs) == ROMFS_MAGIC) &&
+           (get_unaligned(romfs + offsetof(struct romfs_header_t, version)) == ROMFS_VERSION);
+}
+
+int32_t romfs_get_file_by_hash(const uint8_t * romfs, uint32_t h, uint32_t * len) {
+    const struct romfs_file_t* meta;
+    int32_t i;
+
+    if(!header_valid(romfs))
+        return -1;
+
+    i = index_lookup(romfs + sizeof(struct romfs_header_t),
+                     get_unaligned(romfs + offsetof(struct romfs_header_t, count)), h);
+    if(i < 0)
+        return -1;
+
+    meta = (const struct romfs_file_t*)(romfs + get_unaligned(romfs + offsetof(struct romfs_header_t, table_offset)));
+    if (len) {
+        *len = meta[i].length;
+    }
+    return i;
+}
+
+static ssize_t romfs_read(struct inode_t* inode, void* buf, size_t count, off_t offset) {
+    const romfs_mount_t* mount = (const romfs_mount_t*)inode->opaque;
+    const struct romfs_file_t* file = mount->table + inode->number;
+    uint32_t size = file->length;
+
+    if(file->attribute & 1)
+        return -2;
+    if((offset < 0) || (offset >= size))
+        return 0;
+    if ((offset + count) > size)
+        count = size - offset;
+
+    memcpy(buf, get_content_address(mount, file) + offset, count);
+
+    return count;
+}
+
+/* Files are stored contiguously, so the whole remainder is one span */
+static ssize_t romfs_map(struct inode_t* inode, const void** ptr, size_t count, off_t offset) {
+    const romfs_mount_t* mount = (const romfs_mount_t*)inode->opaque;
+    const struct romfs_file_t* file = mount->table + inode->number;
+    uint32_t size = file->length;
+
+    if(file->attribute & 1)
+        return -2;
+    if((offset < 0) || (offset >= size))
+        return 0;
+    if ((offset + count) > size)
+        count = size - offset;
+
+    *ptr = get_content_address(mount, file) + offset;
+
+    return count;
+}
+
+static ssize_t romfs_readdir(struct inode_t* inode, dir_entity_t* ent, off_t offset) {
+    const romfs_mount_t* mount = (const romfs_mount_t*)inode->opaque;
+    const struct romfs_file_t* dir = mount->table + inode->number;
+    const uint8_t* children = get_content_address(mount, dir);
+    const struct romfs_file_t* file;
+    int32_t number;
+
+    if(!(dir->attribute & 1))
+        return -1;
+    if((offset < 0) || (offset >= get_unaligned(children)))
+        return -2;
+
+    number = index_lookup(mount->index, mount->count, get_unaligned(children + 4 + offset * 4));
+    if(number < 0)
+        return -3;
+
+    file = mount->table + number;
+    strncpy(ent->d_name, (const char*)get_data_address(mount, file), file->filename_length);
+    ent->d_name[file->filename_length] = '\0';
+    ent->d_attr = file->attribute;
+
+    return 0;
+}
+
+static off_t romfs_seek(struct inode_t* inode, off_t offset) {
+    const romfs_mount_t* mount = (const romfs_mount_t*)inode->opaque;
+    const struct romfs_file_t* file = mount->table + inode->number;
+    uint32_t size;
+
+    if(file->attribute & 1)
+        size = get_unaligned(get_content_address(mount, file));
+    else
+        size = file->length;
+
+    if(offset > size)
+        offset = size;
+    if(offset < 0)
+        offset = 0;
+
+    return offset;
+}
+
+int romfs_i_lookup(struct inode_t* inode, const char* path){
+    const romfs_mount_t* mount = (const romfs_mount_t*)inode->opaque;
+    const struct romfs_file_t* dir = mount->table + inode->number;
+    const char* slash = strchr(path, '/');
+    uint32_t len = (slash == NULL) ? strlen(path) : (uint32_t)(slash - path);
+    uint32_t h;
+    int32_t ret = -1;
+
+    if(!(dir->attribute & 1))
+        return -2;
+
+    h = hash_djb2_continue(dir->hash, (const uint8_t*)path, len);
+    ret = index_find(mount, h, path, len, 0);
+    if(ret < 0){
+        /* Directories carry the trailing slash in their hash */
+        h = hash_djb2_continue(h, (const uint8_t*)"/", -1);
+        ret = index_find(mount, h, path, len, 1);
+    }
+
+    return (ret < 0) ? -3 : ret;
+}
+
+int romfs_read_inode(inode_t* inode){
+    for(uint32_t i = 0; i < MAX_ROMFS_MOUNTS; i++){
+        if((romfs_mounts[i].image) && (romfs_mounts[i].device == inode->device)){
+            if(inode->number >= romfs_mounts[i].count)
+                return -1;
+
+            inode->mode = romfs_mounts[i].table[inode->number].attribute;
+            inode->block_size = 1;
+            inode->inode_ops.i_lookup = romfs_i_lookup;
+            inode->file_ops.lseek = romfs_seek;
+            inode->file_ops.read = romfs_read;
+            inode->file_ops.readdir = romfs_readdir;
+            inode->file_ops.map = romfs_map;
+            inode->opaque = romfs_mounts + i;
+
+            return 0;
+        }
+    }
+
+    return -2;
+}
+
+/* opaque is the address of the image, e.g. &_sromfs */
+int romfs_read_superblock(void* opaque, struct superblock_t* sb){
+    romfs_mount_t* mount = NULL;
+
+    for(uint32_t i = 0; i < MAX_ROMFS_MOUNTS; i++){
+        if(!romfs_mounts[i].image){
+            mount = romfs_mounts + i;
+            break;
+        }
+    }
+    if(!mount)
+        return -1;
+
+    if(!header_valid((const uint8_t*)opaque))
+        return -2;
+
+    mount->image = (const uint8_t*)opaque;
+    mount->count = get_unaligned(mount->image + offsetof(struct romfs_header_t, count));
+    mount->index = mount->image + sizeof(struct romfs_header_t);
+    mount->table = (const struct romfs_file_t*)(mount->image + get_unaligned(mount->image + offsetof(struct romfs_header_t, table_offset)));
+    mount->data = mount->image + get_unaligned(mount->image + offsetof(struct romfs_header_t, data_offset));
+    mount->device = device_count++;
+    if(!mount->count){
+        mount->image = NULL;
+        return -2;
+    }
+
+    sb->device = mount->device;
+    sb->mounted = 0;
+    sb->block_size = 1;
+    sb->type_hash = ROMFS_TYPE;
+    sb->superblock_ops.s_read_inode = romfs_read_inode;
+    sb->opaque = mount;
+    return 0;
+}
+
+static fs_type_t romfs_r = {
+    .type_name_hash = ROMFS_TYPE,
+    .rsbcb = romfs_read_superblock,
+    .require_dev = 1,
+    .next = NULL,
+};
+
+void register_romfs() {
+//    DBGOUT("Registering romfs\r\n");
+    register_fs(&romfs_r);
+}
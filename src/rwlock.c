@@ -0,0 +1,75 @@
+#include <FreeRTOS.h>
+#include <semphr.h>
+#include <task.h>
+#include "rwlock.h"
+#include "pool.h"
+
+/* A lock goes back to the pool with its semaphore, which is free again by
+ * then, so the semaphore is only created the first time a slot is used */
+POOL_DEFINE(rwlock_pool, rwlock_t, RWLOCK_POOL_SIZE)
+
+rwlock_t* rwlock_create(void){
+    rwlock_t* rw = rwlock_pool_get();
+
+    if(!rw)
+        return NULL;
+
+    if(!rw->lock){
+        vSemaphoreCreateBinary(rw->lock);
+        if(!rw->lock){
+            rwlock_pool_put(rw);
+            return NULL;
+        }
+    }
+    rw->readers = 0;
+    rw->writers_waiting = 0;
+    return rw;
+}
+
+void rwlock_delete(rwlock_t* rw){
+    rwlock_pool_put(rw);
+}
+
+void rwlock_read_lock(rwlock_t* rw){
+    /* Join the readers already holding the lock */
+    taskENTER_CRITICAL();
+    if(rw->readers && !rw->writers_waiting){
+        rw->readers++;
+        taskEXIT_CRITICAL();
+        return;
+    }
+    taskEXIT_CRITICAL();
+
+    /* First reader of a new group, queue up with the writers */
+    xSemaphoreTake(rw->lock, portMAX_DELAY);
+    taskENTER_CRITICAL();
+    rw->readers++;
+    taskEXIT_CRITICAL();
+}
+
+void rwlock_read_unlock(rwlock_t* rw){
+    uint32_t last;
+
+    taskENTER_CRITICAL();
+    last = (--rw->readers == 0);
+    taskEXIT_CRITICAL();
+
+    if(last)
+        xSemaphoreGive(rw->lock);
+}
+
+void rwlock_write_lock(rwlock_t* rw){
+    taskENTER_CRITICAL();
+    rw->writers_waiting++;
+    taskEXIT_CRITICAL();
+
+    xSemaphoreTake(rw->lock, portMAX_DELAY);
+
+    taskENTER_CRITICAL();
+    rw->writers_waiting--;
+    taskEXIT_CRITICAL();
+}
+
+void rwlock_write_unlock(rwlock_t* rw){
+    xSemaphoreGive(rw->lock);
+}
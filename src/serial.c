@@ -0,0 +1,378 @@
+#include "stm32f10x.h"
+#include "stm32f10x_rcc.h"
+#include "stm32f10x_usart.h"
+#include "stm32f10x_dma.h"
+#include "misc.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+#include <string.h>
+
+#include "serial.h"
+#include "fio.h"
+#include "trace.h"
+
+#define TX_MASK (SERIAL_TX_BUFFER_SIZE - 1)
+
+/* TX: head and tail are free running, head - tail bytes are queued. Writers
+ * only move head, the DMA completion interrupt only moves tail. */
+static uint8_t tx_ring[SERIAL_TX_BUFFER_SIZE];
+static volatile uint32_t tx_head = 0;
+static volatile uint32_t tx_tail = 0;
+/* Length of the transfer in flight, 0 when the channel is idle */
+static volatile uint32_t tx_dma_len = 0;
+
+static xSemaphoreHandle tx_lock = NULL;
+static xSemaphoreHandle tx_space = NULL;
+
+#define RX_MASK (SERIAL_RX_BUFFER_SIZE - 1)
+#define INPUT_MASK (SERIAL_INPUT_BUFFER_SIZE - 1)
+
+/* Filled by the receive interrupt, drained by the line discipline task */
+static uint8_t rx_ring[SERIAL_RX_BUFFER_SIZE];
+static volatile uint32_t rx_head = 0;
+static volatile uint32_t rx_tail = 0;
+static volatile uint32_t rx_dropped = 0;
+static xSemaphoreHandle rx_data = NULL;
+
+/* Filled by the line discipline task, drained by serial_read. in_lines
+ * counts the '\n' bytes in the ring in either mode, so switching modes
+ * never leaves it out of step. */
+static uint8_t in_ring[SERIAL_INPUT_BUFFER_SIZE];
+static volatile uint32_t in_head = 0;
+static volatile uint32_t in_tail = 0;
+static volatile uint32_t in_lines = 0;
+static volatile int in_raw = 0;
+static xSemaphoreHandle in_lock = NULL;
+static xSemaphoreHandle in_ready = NULL;
+static xSemaphoreHandle in_space = NULL;
+
+/* Runs with the DMA interrupt masked, either from the ISR itself or from
+ * inside a critical section */
+static void tx_start(void)
+{
+    uint32_t start, len;
+
+    if (tx_dma_len || (tx_head == tx_tail))
+        return;
+
+    /* One contiguous run at a time, a wrapped tail goes out next round */
+    start = tx_tail & TX_MASK;
+    len = tx_head - tx_tail;
+    if (len > SERIAL_TX_BUFFER_SIZE - start)
+        len = SERIAL_TX_BUFFER_SIZE - start;
+
+    DMA_Cmd(DMA1_Channel7, DISABLE);
+    DMA1_Channel7->CMAR = (uint32_t)(tx_ring + start);
+    DMA1_Channel7->CNDTR = len;
+    tx_dma_len = len;
+    DMA_Cmd(DMA1_Channel7, ENABLE);
+}
+
+void DMA1_Channel7_IRQHandler(void)
+{
+    portBASE_TYPE xHigherPriorityTaskWoken = pdFALSE;
+
+    trace_isr_enter();
+
+    if (DMA_GetITStatus(DMA1_IT_TC7) != RESET) {
+        DMA_ClearITPendingBit(DMA1_IT_TC7);
+
+        tx_tail += tx_dma_len;
+        tx_dma_len = 0;
+        tx_start();
+
+        xSemaphoreGiveFromISR(tx_space, &xHigherPriorityTaskWoken);
+    }
+
+    portEND_SWITCHING_ISR(xHigherPriorityTaskWoken);
+}
+
+void USART2_IRQHandler(void)
+{
+    portBASE_TYPE xHigherPriorityTaskWoken = pdFALSE;
+    uint8_t ch;
+    int overrun;
+
+    trace_isr_enter();
+
+    /* A byte arrived while DR was still full and was lost. ORE is cleared
+     * by this SR read followed by the DR read below. */
+    overrun = (USART_GetFlagStatus(USART2, USART_FLAG_ORE) != RESET);
+    if (overrun)
+        rx_dropped++;
+
+    if (USART_GetITStatus(USART2, USART_IT_RXNE) != RESET) {
+        ch = USART_ReceiveData(USART2);
+        if (rx_head - rx_tail < SERIAL_RX_BUFFER_SIZE) {
+            rx_ring[rx_head & RX_MASK] = ch;
+            rx_head++;
+            xSemaphoreGiveFromISR(rx_data, &xHigherPriorityTaskWoken);
+        } else {
+            rx_dropped++;
+        }
+    } else if (overrun) {
+        USART_ReceiveData(USART2);
+    }
+
+    portEND_SWITCHING_ISR(xHigherPriorityTaskWoken);
+}
+
+/* Only the line discipline task adds input, it waits here for room */
+static void input_put(const uint8_t* data, uint32_t len)
+{
+    uint32_t space, start, n, lines;
+
+    while (len) {
+        space = SERIAL_INPUT_BUFFER_SIZE - (in_head - in_tail);
+        if (!space) {
+            xSemaphoreTake(in_space, portMAX_DELAY);
+            continue;
+        }
+
+        start = in_head & INPUT_MASK;
+        n = SERIAL_INPUT_BUFFER_SIZE - start;
+        if (n > space)
+            n = space;
+        if (n > len)
+            n = len;
+
+        lines = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            if ((in_ring[start + i] = data[i]) == '\n')
+                lines++;
+        }
+        data += n;
+        len -= n;
+
+        taskENTER_CRITICAL();
+        in_head += n;
+        in_lines += lines;
+        taskEXIT_CRITICAL();
+    }
+    xSemaphoreGive(in_ready);
+}
+
+enum { ESC = 27, BACKSPACE = 127 };
+enum { LDISC_NORMAL, LDISC_ESC, LDISC_CSI };
+
+static void serial_ldisc(void* pvParameters)
+{
+    uint8_t line[SERIAL_LINE_MAX];
+    uint32_t len = 0, start, n;
+    int state = LDISC_NORMAL, last_cr = 0;
+    uint8_t ch;
+
+    while (1) {
+        xSemaphoreTake(rx_data, portMAX_DELAY);
+
+        while (rx_tail != rx_head) {
+            if (in_raw) {
+                /* Hand over the whole contiguous run at once */
+                start = rx_tail & RX_MASK;
+                n = rx_head - rx_tail;
+                if (n > SERIAL_RX_BUFFER_SIZE - start)
+                    n = SERIAL_RX_BUFFER_SIZE - start;
+                input_put(rx_ring + start, n);
+                rx_tail += n;
+                continue;
+            }
+
+            ch = rx_ring[rx_tail & RX_MASK];
+            rx_tail++;
+
+            /* Swallow ESC [ <params> <final> */
+            if (state == LDISC_ESC) {
+                state = (ch == '[') ? LDISC_CSI : LDISC_NORMAL;
+                continue;
+            }
+            if (state == LDISC_CSI) {
+                if ((ch < '0') || (ch > '9'))
+                    state = LDISC_NORMAL;
+                continue;
+            }
+
+            switch (ch) {
+            case '\n':
+                /* The second half of a CR LF pair */
+                if (last_cr) {
+                    last_cr = 0;
+                    break;
+                }
+                /* fall through */
+            case '\r':
+                last_cr = (ch == '\r');
+                line[len++] = '\n';
+                input_put(line, len);
+                len = 0;
+                break;
+            case ESC:
+                last_cr = 0;
+                state = LDISC_ESC;
+                break;
+            case '\b':
+            case BACKSPACE:
+                last_cr = 0;
+                if (len) {
+                    serial_write("\b \b", 3);
+                    len--;
+                }
+                break;
+            default:
+                last_cr = 0;
+                /* Keep a byte for the line end */
+                if (len < SERIAL_LINE_MAX - 1) {
+                    line[len++] = ch;
+                    serial_write(&ch, 1);
+                }
+            }
+        }
+    }
+}
+
+size_t serial_read(void* buf, size_t count)
+{
+    uint8_t* dst = (uint8_t*)buf;
+    size_t n = 0;
+    uint8_t ch;
+
+    xSemaphoreTake(in_lock, portMAX_DELAY);
+    while (in_raw ? (in_head == in_tail) : !in_lines)
+        xSemaphoreTake(in_ready, portMAX_DELAY);
+
+    while ((n < count) && (in_tail != in_head)) {
+        ch = in_ring[in_tail & INPUT_MASK];
+        in_tail++;
+        if (ch == '\n') {
+            taskENTER_CRITICAL();
+            in_lines--;
+            taskEXIT_CRITICAL();
+            if (!in_raw) {
+                dst[n++] = '\0';
+                break;
+            }
+        }
+        dst[n++] = ch;
+    }
+    xSemaphoreGive(in_space);
+    xSemaphoreGive(in_lock);
+
+    return n;
+}
+
+/* Queued input is left alone, only bytes received from now on are
+ * affected */
+void serial_set_raw(int raw)
+{
+    in_raw = raw;
+    xSemaphoreGive(in_ready);
+}
+
+uint32_t serial_rx_dropped(void)
+{
+    return rx_dropped;
+}
+
+void serial_init(void)
+{
+    DMA_InitTypeDef DMA_InitStructure;
+    NVIC_InitTypeDef NVIC_InitStructure;
+
+    tx_lock = xSemaphoreCreateMutex();
+    vSemaphoreCreateBinary(tx_space);
+    vSemaphoreCreateBinary(rx_data);
+    in_lock = xSemaphoreCreateMutex();
+    vSemaphoreCreateBinary(in_ready);
+    vSemaphoreCreateBinary(in_space);
+
+    RCC_AHBPeriphClockCmd(RCC_AHBPeriph_DMA1, ENABLE);
+
+    /* USART2 TX requests are routed to DMA1 Channel7 */
+    DMA_DeInit(DMA1_Channel7);
+    DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)&USART2->DR;
+    DMA_InitStructure.DMA_MemoryBaseAddr = (uint32_t)tx_ring;
+    DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralDST;
+    DMA_InitStructure.DMA_BufferSize = 1;
+    DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+    DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+    DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
+    DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
+    DMA_InitStructure.DMA_Mode = DMA_Mode_Normal;
+    DMA_InitStructure.DMA_Priority = DMA_Priority_Low;
+    DMA_InitStructure.DMA_M2M = DMA_M2M_Disable;
+    DMA_Init(DMA1_Channel7, &DMA_InitStructure);
+    DMA_ITConfig(DMA1_Channel7, DMA_IT_TC, ENABLE);
+
+    USART_DMACmd(USART2, USART_DMAReq_Tx, ENABLE);
+
+    /* Has to be at or below configMAX_SYSCALL_INTERRUPT_PRIORITY since the
+     * handler gives a semaphore */
+    NVIC_InitStructure.NVIC_IRQChannel = DMA1_Channel7_IRQn;
+    NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = configLIBRARY_KERNEL_INTERRUPT_PRIORITY;
+    NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
+    NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+    NVIC_Init(&NVIC_InitStructure);
+
+    NVIC_InitStructure.NVIC_IRQChannel = USART2_IRQn;
+    NVIC_Init(&NVIC_InitStructure);
+
+    /* Above the shell so pasted input is moved out of the ISR ring quickly */
+    xTaskCreate(serial_ldisc,
+                (signed portCHAR *) "ldisc",
+                configMINIMAL_STACK_SIZE + SERIAL_LINE_MAX / sizeof(portSTACK_TYPE),
+                NULL, tskIDLE_PRIORITY + 3, NULL);
+}
+
+/* The caller holds tx_lock */
+static void tx_queue(const uint8_t* src, size_t left)
+{
+    uint32_t space, start, len;
+
+    while (left) {
+        space = SERIAL_TX_BUFFER_SIZE - (tx_head - tx_tail);
+        if (!space) {
+            /* Full means a transfer is in flight, its completion frees room */
+            xSemaphoreTake(tx_space, portMAX_DELAY);
+            continue;
+        }
+
+        start = tx_head & TX_MASK;
+        len = SERIAL_TX_BUFFER_SIZE - start;
+        if (len > space)
+            len = space;
+        if (len > left)
+            len = left;
+
+        memcpy(tx_ring + start, src, len);
+        src += len;
+        left -= len;
+
+        taskENTER_CRITICAL();
+        tx_head += len;
+        tx_start();
+        taskEXIT_CRITICAL();
+    }
+}
+
+size_t serial_write(const void* buf, size_t count)
+{
+    xSemaphoreTake(tx_lock, portMAX_DELAY);
+    tx_queue((const uint8_t*)buf, count);
+    xSemaphoreGive(tx_lock);
+
+    return count;
+}
+
+size_t serial_writev(const struct fio_iovec_t* iov, int iovcnt)
+{
+    size_t count = 0;
+
+    xSemaphoreTake(tx_lock, portMAX_DELAY);
+    for (int i = 0; i < iovcnt; i++) {
+        tx_queue((const uint8_t*)iov[i].base, iov[i].len);
+        count += iov[i].len;
+    }
+    xSemaphoreGive(tx_lock);
+
+    return count;
+}
@@ -9,6 +9,10 @@
 #include "task.h"
 #include "host.h"
 #include "devfs.h"
+#include "log.h"
+#include "trace.h"
+#include "heap_stats.h"
+#include "pool.h"
 
 typedef struct {
 	const char *name;
@@ -27,6 +31,12 @@ void mmtest_command(int, char **);
 void mkdir_command(int, char **);
 void test_command(int, char **);
 void test_ramfs_command(int, char **);
+void fsstat_command(int, char **);
+void log_command(int, char **);
+void trace_command(int, char **);
+void heap_command(int, char **);
+
+arena_t *cmd_arena = NULL;
 
 #define MKCL(n, d) {.name=#n, .fptr=n ## _command, .desc=d}
 
@@ -37,10 +47,14 @@ cmdlist cl[]={
 	MKCL(ps, "Report a snapshot of the current processes"),
 	MKCL(host, "Run command on host"),
 	MKCL(mkdir, "Make Directory"),
-	MKCL(mmtest, "heap memory allocation test"),
+	MKCL(mmtest, "Benchmark the heap: mmtest [profile|all] [ops] [seed]"),
 	MKCL(help, "help"),
 	MKCL(test, "test new function"),
     MKCL(test_ramfs, "test ramfs"),
+    MKCL(fsstat, "Report filesystem cache statistics"),
+    MKCL(log, "Show log statistics or set the sink: log [uart|off|<file>]"),
+    MKCL(trace, "Kernel event trace: trace [on|off|clear|dump|save [<file>]]"),
+    MKCL(heap, "Report heap and object pool usage: heap [-h]"),
 };
 
 int parse_command(char *str, char *argv[]){
@@ -130,7 +144,8 @@ void ls_command(int n, char *argv[]){
 }
 
 int filedump(const char* filename){
-	char buf[128];
+	const void *data;
+	off_t offset=0;
 
 	int fd=fio_open(filename, 0, O_RDONLY);
 
@@ -140,8 +155,10 @@ int filedump(const char* filename){
 	fio_printf(1, "\r\n");
 
 	int count;
-	while((count=fio_read(fd, buf, sizeof(buf)))>0){
-		fio_write(1, buf, count);
+	while((count=fio_map(fd, offset, 128, &data))>0){
+		fio_write(1, data, count);
+		fio_unmap(fd, data);
+		offset+=count;
 	}
 
 	fio_close(fd);
@@ -149,7 +166,11 @@ int filedump(const char* filename){
 }
 
 void ps_command(int n, char *argv[]){
-	signed char buf[1024];
+	/* About 40 bytes per task, kept off the shell's stack */
+	signed char *buf = arena_alloc(cmd_arena, 1024);
+
+	if(!buf)
+		return;
 	vTaskList(buf);
         fio_printf(1, "\n\rName          State   Priority  Stack  Num\n\r");
         fio_printf(1, "*******************************************\n\r");
@@ -174,7 +195,11 @@ void man_command(int n, char *argv[]){
 		return;
 	}
 
-	char buf[128]="/romfs/manual/";
+	char *buf = arena_alloc(cmd_arena, sizeof("/romfs/manual/") + strlen(argv[1]));
+
+	if(!buf)
+		return;
+	strcpy(buf, "/romfs/manual/");
 	strcat(buf, argv[1]);
 
 	if(!filedump(buf))
@@ -183,9 +208,14 @@ void man_command(int n, char *argv[]){
 
 void host_command(int n, char *argv[]){
     int i, len = 0, rnt;
-    char command[128] = {0};
+    char *command;
 
     if(n>1){
+        for(i = 1; i < n; i++)
+            len += strlen(argv[i]) + 1;
+        if(!(command = arena_alloc(cmd_arena, len)))
+            return;
+        len = 0;
         for(i = 1; i < n; i++) {
             memcpy(&command[len], argv[i], strlen(argv[i]));
             len += (strlen(argv[i]) + 1);
@@ -269,6 +299,84 @@ void test_ramfs_command(int n, char *argv[]) {
     return;
 }
 
+void fsstat_command(int n, char *argv[]) {
+    fs_dcache_stat_t dstat;
+    fs_icache_stat_t istat;
+
+    fs_dcache_stat(&dstat);
+    fs_icache_stat(&istat);
+
+    fio_printf(1, "\r\ndcache: size %d, hits %d, misses %d, replaces %d, invalidations %d\r\n",
+               dstat.size, dstat.hits, dstat.misses, dstat.replaces, dstat.invalidations);
+    fio_printf(1, "icache: size %d, hits %d, misses %d, evictions %d, failures %d\r\n",
+               istat.size, istat.hits, istat.misses, istat.evictions, istat.failures);
+}
+
+void log_command(int n, char *argv[]) {
+    log_stat_t stat;
+    int fd, old;
+
+    fio_printf(1, "\r\n");
+    if(n > 1){
+        if(!strcmp(argv[1], "uart"))
+            fd = 1;
+        else if(!strcmp(argv[1], "off"))
+            fd = -1;
+        else if((fd = fio_open(argv[1], O_CREAT | O_TRUNC, 0)) < 0){
+            fio_printf(2, "Can not open %s\r\n", argv[1]);
+            return;
+        }
+        log_flush();
+        old = log_set_sink(fd);
+        /* stdin, stdout and stderr stay open */
+        if(old > 2)
+            fio_close(old);
+        return;
+    }
+
+    log_stat(&stat);
+    fio_printf(1, "records %u, bytes %u, dropped %u, flushed %u, sink errors %u, high water %u/%u\r\n",
+               stat.records, stat.bytes, stat.dropped, stat.flushed, stat.sink_errors,
+               stat.high_water, LOG_RING_SIZE);
+}
+
+/* dump writes the gdb2vcd.pl input to stdout, save to a file, by default
+ * on the host through semihosting */
+void trace_command(int n, char *argv[]) {
+    trace_stat_t stat;
+    const char *path;
+    int fd;
+
+    fio_printf(1, "\r\n");
+    if(n > 1){
+        if(!strcmp(argv[1], "on")){
+            trace_enable(1);
+        }else if(!strcmp(argv[1], "off")){
+            trace_enable(0);
+        }else if(!strcmp(argv[1], "clear")){
+            trace_clear();
+        }else if(!strcmp(argv[1], "dump")){
+            trace_dump(1);
+        }else if(!strcmp(argv[1], "save")){
+            path = (n > 2) ? argv[2] : TRACE_DUMP_FILE;
+            if((fd = fio_open(path, O_CREAT | O_TRUNC, 0)) < 0){
+                fio_printf(2, "Can not open %s\r\n", path);
+                return;
+            }
+            if(trace_dump(fd) < 0)
+                fio_printf(2, "Write to %s failed\r\n", path);
+            fio_close(fd);
+        }else{
+            fio_printf(2, "Usage: trace [on|off|clear|dump|save [<file>]]\r\n");
+        }
+        return;
+    }
+
+    trace_stat(&stat);
+    fio_printf(1, "%s, events %u, lost %u, ring %u\r\n",
+               stat.enabled ? "on" : "off", stat.events, stat.lost, TRACE_RING_SIZE);
+}
+
 cmdfunc *do_command(const char *cmd){
 
 	int i;
@@ -279,3 +387,39 @@ cmdfunc *do_command(const char *cmd){
 	}
 	return NULL;	
 }
+
+/* -h adds the free and used block counts per power of 2 size class */
+void heap_command(int n, char *argv[]) {
+    xHeapStats stat;
+    xHeapHistogram hist;
+    pool_stat_t pool;
+    int i;
+
+    vPortGetHeapStats(&stat);
+    fio_printf(1, "\r\nfree %u/%u, min ever %u, largest block %u in %u free blocks\r\n",
+               stat.xAvailableHeapSpaceInBytes, configTOTAL_HEAP_SIZE,
+               stat.xMinimumEverFreeBytesRemaining,
+               stat.xSizeOfLargestFreeBlockInBytes, stat.xNumberOfFreeBlocks);
+    fio_printf(1, "malloc %u, free %u, failed %u\r\n",
+               stat.xNumberOfSuccessfulAllocations, stat.xNumberOfSuccessfulFrees,
+               stat.xNumberOfFailedAllocations);
+
+    for(i = 0; !pool_stat(i, &pool); i++)
+        fio_printf(1, "pool %s: %u/%u x %u bytes, high water %u, failed %u\r\n",
+                   pool.name, pool.used, pool.capacity, pool.object_size,
+                   pool.high_water, pool.failures);
+    if(cmd_arena)
+        fio_printf(1, "command arena: peak %u/%u, heap chunks %u\r\n",
+                   cmd_arena->peak, cmd_arena->size, cmd_arena->overflows);
+
+    if(n < 2 || strcmp(argv[1], "-h"))
+        return;
+
+    vPortGetHeapHistogram(&hist);
+    fio_printf(1, "%10s %6s %6s\r\n", "size", "free", "used");
+    for(i = 0; i < heapHISTOGRAM_CLASSES; i++){
+        if(!hist.ulFreeBlocks[i] && !hist.ulUsedBlocks[i])
+            continue;
+        fio_printf(1, "%9u+ %6u %6u\r\n", 1u << i, hist.ulFreeBlocks[i], hist.ulUsedBlocks[i]);
+    }
+}
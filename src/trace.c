@@ -0,0 +1,168 @@
+#include <string.h>
+#include "stm32f10x.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "trace.h"
+#include "fio.h"
+#include "clib.h"
+
+/* Writers run inside the kernel with interrupts masked or in interrupt
+ * handlers that may nest, so a slot is claimed with one atomic add and
+ * filled in place. The dump pauses tracing before it reads the ring. */
+#define TRACE_MASK (TRACE_RING_SIZE - 1)
+
+typedef struct trace_task_t{
+    uint32_t handle;
+    char name[TRACE_NAME_MAX];
+}trace_task_t;
+
+static trace_rec_t trace_ring[TRACE_RING_SIZE];
+static volatile uint32_t trace_head = 0;
+static volatile int trace_enabled = 1;
+
+/* Counted by the tick hook, xTaskGetTickCountFromISR would unmask
+ * interrupts inside the kernel's critical sections */
+static volatile uint32_t trace_ticks = 0;
+
+/* The task switched out, its record is only written if another task is
+ * switched in so that ticks without a switch cost no records */
+static void* trace_out_task = NULL;
+
+static trace_task_t trace_tasks[TRACE_MAX_TASKS];
+static int trace_ntasks = 0;
+
+static void trace_put(uint32_t event, uint32_t obj){
+    trace_rec_t* rec;
+    uint32_t load = SysTick->LOAD;
+    uint32_t val = SysTick->VAL;
+    uint32_t tick = trace_ticks;
+
+    /* The counter reloaded but the tick interrupt has not run yet */
+    if((SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) && (val > load / 2))
+        tick++;
+
+    rec = &trace_ring[__sync_fetch_and_add(&trace_head, 1) & TRACE_MASK];
+    rec->tick = tick;
+    rec->stamp = ((load - val) << 8) | event;
+    rec->obj = obj;
+}
+
+void trace_tick(){
+    trace_ticks++;
+}
+
+void trace_task_create(void* task, const signed char* name){
+    trace_task_t* t = NULL;
+    int i;
+
+    /* A deleted task's handle can come back with a new name */
+    for(i = 0; i < trace_ntasks; i++){
+        if(trace_tasks[i].handle == (uint32_t)(uintptr_t)task){
+            t = &trace_tasks[i];
+            break;
+        }
+    }
+    if(!t){
+        if(trace_ntasks == TRACE_MAX_TASKS)
+            return;
+        t = &trace_tasks[trace_ntasks++];
+        t->handle = (uint32_t)(uintptr_t)task;
+    }
+    strncpy(t->name, (const char*)name, TRACE_NAME_MAX - 1);
+    t->name[TRACE_NAME_MAX - 1] = '\0';
+}
+
+void trace_switched_out(void* task){
+    trace_out_task = task;
+}
+
+void trace_switched_in(void* task){
+    if(!trace_enabled || (task == trace_out_task))
+        return;
+    if(trace_out_task)
+        trace_put(TRACE_TASK_OUT, (uint32_t)(uintptr_t)trace_out_task);
+    trace_put(TRACE_TASK_IN, (uint32_t)(uintptr_t)task);
+}
+
+void trace_event(uint32_t event, void* obj){
+    if(trace_enabled)
+        trace_put(event, (uint32_t)(uintptr_t)obj);
+}
+
+void trace_isr_enter(){
+    if(trace_enabled)
+        trace_put(TRACE_ISR_ENTER, (SCB->ICSR & SCB_ICSR_VECTACTIVE_Msk) - 16);
+}
+
+void trace_enable(int on){
+    trace_enabled = on;
+}
+
+void trace_clear(){
+    int was = trace_enabled;
+
+    trace_enabled = 0;
+    trace_head = 0;
+    trace_enabled = was;
+}
+
+void trace_stat(trace_stat_t* stat){
+    uint32_t head = trace_head;
+
+    stat->events = head;
+    stat->lost = (head > TRACE_RING_SIZE) ? head - TRACE_RING_SIZE : 0;
+    stat->enabled = trace_enabled;
+}
+
+/* Formats one record as a line, 0 for a slot that was never written */
+static int trace_format(char* line, size_t size, const trace_rec_t* rec){
+    static const char* const names[] = {
+        NULL, "in", "out", "send", "recv", "isr",
+    };
+    uint32_t event = rec->stamp & 0xff;
+    uint32_t cycles = rec->stamp >> 8;
+    uint32_t us, ms;
+
+    if((event < TRACE_TASK_IN) || (event > TRACE_ISR_ENTER))
+        return 0;
+
+    /* gdb2vcd.pl works in milliseconds and ignores the fraction */
+    us = (rec->tick % configTICK_RATE_HZ) * (1000000 / configTICK_RATE_HZ) +
+         cycles / (configCPU_CLOCK_HZ / 1000000);
+    ms = (rec->tick / configTICK_RATE_HZ) * 1000 + us / 1000;
+
+    return snprintf(line, size,
+                    (event == TRACE_ISR_ENTER) ? "%%%s,%u.%03u,%u\n" : "%%%s,%u.%03u,0x%08x\n",
+                    names[event], (unsigned int)ms, (unsigned int)(us % 1000),
+                    (unsigned int)rec->obj);
+}
+
+static int trace_put_line(int fd, const char* line, int len){
+    if(len <= 0)
+        return 0;
+    return (fio_write(fd, line, len) == len) ? 0 : -1;
+}
+
+int trace_dump(int fd){
+    char line[TRACE_NAME_MAX + 32];
+    int was = trace_enabled;
+    uint32_t head, pos;
+    int i, r = 0;
+
+    trace_enabled = 0;
+    head = trace_head;
+
+    for(i = 0; (i < trace_ntasks) && !r; i++)
+        r = trace_put_line(fd, line,
+                           snprintf(line, sizeof(line), "%%create,0x%08x,\"%s\"\n",
+                                    (unsigned int)trace_tasks[i].handle,
+                                    trace_tasks[i].name));
+
+    pos = (head > TRACE_RING_SIZE) ? head - TRACE_RING_SIZE : 0;
+    for(; (pos != head) && !r; pos++)
+        r = trace_put_line(fd, line,
+                           trace_format(line, sizeof(line), &trace_ring[pos & TRACE_MASK]));
+
+    trace_enabled = was;
+    return r;
+}
@@ -0,0 +1,315 @@
+/* Filesystem microbenchmark, built for the host by `make fsbench` against
+ * the same filesystem.c/fio.c/ramfs.c/devfs.c that run on the target.
+ *
+ * Every case reports ops/sec and the latency distribution of single
+ * calls, so changes to the VFS can be compared run against run.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "filesystem.h"
+#include "fio.h"
+#include "ramfs.h"
+#include "devfs.h"
+#include "log.h"
+
+#define MAX_SAMPLES (64 * 1024)
+#define FILE_SIZE (256 * 1024)
+#define DIR_ENTRIES 200
+
+static uint64_t samples[MAX_SAMPLES];
+static uint32_t sample_count;
+static uint8_t data[FILE_SIZE];
+static uint32_t seed = 0x2545F491;
+
+static uint32_t prng(void){
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static uint64_t now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_u64(const void* a, const void* b){
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static void begin(void){
+    sample_count = 0;
+}
+
+static void record(uint64_t start){
+    if(sample_count < MAX_SAMPLES)
+        samples[sample_count++] = now_ns() - start;
+}
+
+static void report(const char* name, uint32_t size){
+    uint64_t total = 0;
+    char label[48];
+
+    if(!sample_count)
+        return;
+
+    qsort(samples, sample_count, sizeof(uint64_t), cmp_u64);
+    for(uint32_t i = 0; i < sample_count; i++)
+        total += samples[i];
+
+    if(size)
+        snprintf(label, sizeof(label), "%s %u", name, size);
+    else
+        snprintf(label, sizeof(label), "%s", name);
+
+    printf("%-22s %8u %12.0f %8lu %8lu %8lu %8lu %10.1f\n",
+           label, sample_count,
+           sample_count * 1e9 / (total ? total : 1),
+           (unsigned long)samples[sample_count / 2],
+           (unsigned long)samples[sample_count * 9 / 10],
+           (unsigned long)samples[sample_count * 99 / 100],
+           (unsigned long)samples[sample_count - 1],
+           size ? (double)size * sample_count / (total ? total : 1) * 1e9 / (1024 * 1024) : 0.0);
+}
+
+static void bench_open_close(uint32_t iterations){
+    char path[32];
+    int fd;
+
+    for(int i = 0; i < 16; i++){
+        snprintf(path, sizeof(path), "/bench/oc%d", i);
+        fio_close(fio_open(path, O_CREAT, 0));
+    }
+
+    begin();
+    for(uint32_t i = 0; i < iterations; i++){
+        snprintf(path, sizeof(path), "/bench/oc%u", i & 15);
+        uint64_t start = now_ns();
+        fd = fio_open(path, 0, 0);
+        fio_close(fd);
+        record(start);
+    }
+    report("open/close", 0);
+}
+
+static void bench_seq(uint32_t size){
+    char path[32];
+    int fd;
+
+    snprintf(path, sizeof(path), "/bench/seq%u", size);
+    fd = fio_open(path, O_CREAT | O_TRUNC, 0);
+
+    begin();
+    for(uint32_t off = 0; off + size <= FILE_SIZE; off += size){
+        uint64_t start = now_ns();
+        fio_write(fd, data + off, size);
+        record(start);
+    }
+    report("seq write", size);
+
+    fio_seek(fd, 0, SEEK_SET);
+    begin();
+    for(uint32_t off = 0; off + size <= FILE_SIZE; off += size){
+        static uint8_t buf[FILE_SIZE];
+        uint64_t start = now_ns();
+        fio_read(fd, buf, size);
+        record(start);
+        if(memcmp(buf, data + off, size)){
+            fprintf(stderr, "seq read mismatch at %u\n", off);
+            exit(1);
+        }
+    }
+    report("seq read", size);
+
+    fio_close(fd);
+}
+
+static void bench_random(uint32_t size, uint32_t iterations){
+    static uint8_t buf[FILE_SIZE];
+    int fd = fio_open("/bench/random", O_CREAT, 0);
+
+    if(fio_seek(fd, 0, SEEK_END) < FILE_SIZE){
+        fio_seek(fd, 0, SEEK_SET);
+        fio_write(fd, data, FILE_SIZE);
+    }
+
+    begin();
+    for(uint32_t i = 0; i < iterations; i++){
+        uint32_t off = prng() % (FILE_SIZE - size);
+        uint64_t start = now_ns();
+        fio_seek(fd, off, SEEK_SET);
+        fio_write(fd, data + off, size);
+        record(start);
+    }
+    report("rand write", size);
+
+    begin();
+    for(uint32_t i = 0; i < iterations; i++){
+        uint32_t off = prng() % (FILE_SIZE - size);
+        uint64_t start = now_ns();
+        fio_seek(fd, off, SEEK_SET);
+        fio_read(fd, buf, size);
+        record(start);
+    }
+    report("rand read", size);
+
+    fio_close(fd);
+}
+
+/* Latency seen by the submitter, the I/O task does the writes meanwhile */
+static void bench_aio(uint32_t size, uint32_t iterations){
+    static fio_aio_t reqs[32];
+    int fd = fio_open("/bench/aio", O_CREAT | O_TRUNC, 0);
+    fio_aio_t* req;
+
+    memset(reqs, 0, sizeof(reqs));
+    begin();
+    for(uint32_t i = 0; i < iterations; i++){
+        req = reqs + (i & 31);
+        fio_wait(req, portMAX_DELAY);
+        req->fd = fd;
+        req->op = FIO_AIO_WRITE;
+        req->buf = data + (i * size) % (FILE_SIZE - size);
+        req->count = size;
+        req->offset = -1;
+        uint64_t start = now_ns();
+        fio_submit(req);
+        record(start);
+    }
+    report("aio write", size);
+
+    for(uint32_t i = 0; i < 32; i++)
+        fio_wait(reqs + i, portMAX_DELAY);
+    if(fio_seek(fd, 0, SEEK_END) != (off_t)size * iterations){
+        fprintf(stderr, "aio write lost data\n");
+        exit(1);
+    }
+    fio_close(fd);
+}
+
+/* Cost to the producer only. The ring is drained every half ring of
+ * records, outside the timed region, so the case measures records being
+ * queued rather than the early return of a full ring. */
+static void bench_log(uint32_t size, uint32_t iterations){
+    log_stat_t stat;
+    uint32_t batch = LOG_RING_SIZE / 2 / (sizeof(uint32_t) + ((size + 3) & ~3U));
+    int fd = fio_open("/bench/log", O_CREAT | O_TRUNC, 0);
+
+    log_set_sink(fd);
+    begin();
+    for(uint32_t i = 0; i < iterations; i++){
+        if(i && !(i % batch))
+            log_flush();
+        uint64_t start = now_ns();
+        if(log_write(data + (i * size) % (FILE_SIZE - size), size) >= 0)
+            record(start);
+    }
+    report("log write", size);
+
+    log_flush();
+    log_set_sink(-1);
+    log_stat(&stat);
+    if((fio_seek(fd, 0, SEEK_END) != (off_t)stat.flushed) || (stat.flushed != stat.bytes) ||
+       (stat.records + stat.dropped != iterations)){
+        fprintf(stderr, "log lost data\n");
+        exit(1);
+    }
+    printf("%-22s %8u dropped\n", "", stat.dropped);
+    if(stat.dropped > iterations / 100){
+        fprintf(stderr, "log dropped more than 1%% of the records\n");
+        exit(1);
+    }
+    fio_close(fd);
+}
+
+static void bench_dir(uint32_t iterations){
+    struct dir_entity ent;
+    char path[32];
+    int dd;
+
+    fs_mkdir("/bench/dir/");
+
+    begin();
+    for(uint32_t i = 0; i < DIR_ENTRIES; i++){
+        snprintf(path, sizeof(path), "/bench/dir/d%u/", i);
+        uint64_t start = now_ns();
+        fs_mkdir(path);
+        record(start);
+    }
+    report("mkdir", 0);
+
+    begin();
+    for(uint32_t i = 0; i < iterations; i++){
+        uint64_t start = now_ns();
+        dd = fio_opendir("/bench/dir/");
+        while(fio_readdir(dd, &ent) >= 0);
+        fio_closedir(dd);
+        record(start);
+    }
+    report("readdir 200", 0);
+}
+
+static void usage(const char* binname){
+    printf("Usage: %s [-b <ramfs block size>] [-n <iterations>]\n", binname);
+    exit(-1);
+}
+
+int main(int argc, char** argv){
+    static const uint32_t sizes[] = {16, 64, 256, 1024, 4096};
+    ramfs_mount_opt_t opt = { .block_size = 0 };
+    uint32_t iterations = 20000;
+    char* o;
+
+    for(int i = 1; i < argc; i++){
+        o = argv[i];
+        if((o[0] != '-') || (i + 1 >= argc))
+            usage(argv[0]);
+        switch(o[1]){
+        case 'b':
+            opt.block_size = atoi(argv[++i]);
+            break;
+        case 'n':
+            iterations = atoi(argv[++i]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    for(uint32_t i = 0; i < FILE_SIZE; i++)
+        data[i] = prng();
+
+    fs_init();
+    fio_init();
+    fio_aio_init();
+    log_init();
+    register_devfs();
+    register_ramfs();
+    if(fs_mount(NULL, RAMFS_TYPE, &opt)){
+        fprintf(stderr, "mounting ramfs failed\n");
+        return 1;
+    }
+    fs_mkdir("/bench/");
+
+    printf("ramfs block size %u, %u iterations, latencies in ns\n",
+           opt.block_size ? opt.block_size : RAMFS_DEFAULT_BLOCK_SIZE, iterations);
+    printf("%-22s %8s %12s %8s %8s %8s %8s %10s\n",
+           "case", "ops", "ops/sec", "p50", "p90", "p99", "max", "MiB/s");
+
+    bench_open_close(iterations);
+    for(uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+        bench_seq(sizes[i]);
+    for(uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+        bench_random(sizes[i], iterations);
+    bench_aio(64, iterations);
+    bench_log(32, iterations);
+    bench_dir(iterations / 10);
+
+    return 0;
+}
@@ -0,0 +1,35 @@
+#ifndef __HOST_FREERTOS_H__
+#define __HOST_FREERTOS_H__
+
+/* Minimal stand-in for the FreeRTOS headers, so that the filesystem stack
+ * can be built and measured on a POSIX host. Only what the VFS modules use
+ * is provided, see freertos_shim.c for the implementation. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define portMAX_DELAY ( ( portTickType ) 0xffffffff )
+#define portTICK_RATE_MS ( ( portTickType ) 1 )
+
+#define pdTRUE  1
+#define pdFALSE 0
+#define pdPASS  1
+#define pdFAIL  0
+
+#define portBASE_TYPE long
+#define portCHAR char
+#define portSTACK_TYPE unsigned long
+typedef unsigned long portTickType;
+
+/* Heap settings as in include/FreeRTOSConfig.h, for building the target
+ * heap_XX.c natively, see mmbench in mk/host.mk */
+#define configTOTAL_HEAP_SIZE ( ( size_t ) ( 17 * 1024 ) )
+#define configHEAP_HISTOGRAM 1
+#define portBYTE_ALIGNMENT 8
+#define portBYTE_ALIGNMENT_MASK ( 0x0007 )
+#define portDOUBLE double
+
+void *pvPortMalloc(size_t xWantedSize);
+void vPortFree(void *pv);
+
+#endif
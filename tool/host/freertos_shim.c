@@ -0,0 +1,180 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+#include "fio.h"
+
+typedef struct host_sem_t {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    unsigned long count;
+    unsigned long max;
+}host_sem_t;
+
+static pthread_mutex_t critical = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+void vHostEnterCritical(void){
+    pthread_mutex_lock(&critical);
+}
+
+void vHostExitCritical(void){
+    pthread_mutex_unlock(&critical);
+}
+
+typedef struct host_task_t {
+    pdTASK_CODE code;
+    void* param;
+}host_task_t;
+
+static void* host_task_entry(void* arg){
+    host_task_t task = *(host_task_t*)arg;
+
+    free(arg);
+    task.code(task.param);
+    return NULL;
+}
+
+signed portBASE_TYPE xTaskCreate(pdTASK_CODE pvTaskCode, const signed char * pcName, unsigned short usStackDepth, void * pvParameters, unsigned portBASE_TYPE uxPriority, xTaskHandle * pxCreatedTask){
+    host_task_t* task = (host_task_t*)malloc(sizeof(host_task_t));
+    pthread_t thread;
+
+    if(!task)
+        return pdFAIL;
+    task->code = pvTaskCode;
+    task->param = pvParameters;
+    if(pthread_create(&thread, NULL, host_task_entry, task)){
+        free(task);
+        return pdFAIL;
+    }
+    pthread_detach(thread);
+    if(pxCreatedTask)
+        *pxCreatedTask = (xTaskHandle)thread;
+    return pdPASS;
+}
+
+void vTaskSuspendAll(void){
+    pthread_mutex_lock(&critical);
+}
+
+signed portBASE_TYPE xTaskResumeAll(void){
+    pthread_mutex_unlock(&critical);
+    return pdFALSE;
+}
+
+/* One tick per millisecond */
+portTickType xTaskGetTickCount(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (portTickType)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+void vTaskDelay(portTickType xTicksToDelay){
+    struct timespec ts = {
+        .tv_sec = xTicksToDelay / 1000,
+        .tv_nsec = (xTicksToDelay % 1000) * 1000000,
+    };
+    nanosleep(&ts, NULL);
+}
+
+xSemaphoreHandle xHostSemaphoreCreate(unsigned portBASE_TYPE uxMaxCount, unsigned portBASE_TYPE uxInitialCount){
+    host_sem_t* sem = (host_sem_t*)malloc(sizeof(host_sem_t));
+    if(!sem)
+        return NULL;
+    pthread_mutex_init(&sem->mutex, NULL);
+    pthread_cond_init(&sem->cond, NULL);
+    sem->count = uxInitialCount;
+    sem->max = uxMaxCount;
+    return sem;
+}
+
+signed portBASE_TYPE xHostSemaphoreTake(xSemaphoreHandle xSemaphore, portTickType xBlockTime){
+    host_sem_t* sem = (host_sem_t*)xSemaphore;
+    struct timespec deadline;
+    int err = 0;
+
+    pthread_mutex_lock(&sem->mutex);
+    if((xBlockTime != portMAX_DELAY) && xBlockTime){
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += xBlockTime / 1000;
+        deadline.tv_nsec += (xBlockTime % 1000) * 1000000;
+        if(deadline.tv_nsec >= 1000000000){
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+    while((sem->count == 0) && (err != ETIMEDOUT)){
+        if(xBlockTime == 0)
+            break;
+        else if(xBlockTime == portMAX_DELAY)
+            pthread_cond_wait(&sem->cond, &sem->mutex);
+        else
+            err = pthread_cond_timedwait(&sem->cond, &sem->mutex, &deadline);
+    }
+    if(sem->count == 0){
+        pthread_mutex_unlock(&sem->mutex);
+        return pdFALSE;
+    }
+    sem->count--;
+    pthread_mutex_unlock(&sem->mutex);
+    return pdTRUE;
+}
+
+signed portBASE_TYPE xHostSemaphoreGive(xSemaphoreHandle xSemaphore){
+    host_sem_t* sem = (host_sem_t*)xSemaphore;
+    signed portBASE_TYPE ret = pdFALSE;
+
+    pthread_mutex_lock(&sem->mutex);
+    if(sem->count < sem->max){
+        sem->count++;
+        pthread_cond_signal(&sem->cond);
+        ret = pdTRUE;
+    }
+    pthread_mutex_unlock(&sem->mutex);
+    return ret;
+}
+
+void vHostSemaphoreDelete(xSemaphoreHandle xSemaphore){
+    host_sem_t* sem = (host_sem_t*)xSemaphore;
+    pthread_cond_destroy(&sem->cond);
+    pthread_mutex_destroy(&sem->mutex);
+    free(sem);
+}
+
+/* Serial port of the target, devfs stdin/stdout end up here */
+size_t serial_read(void* buf, size_t count){
+    char* dst = (char*)buf;
+    size_t n = 0;
+    int c;
+
+    while(n < count){
+        c = getchar();
+        if((c == EOF) || (c == '\n')){
+            dst[n++] = '\0';
+            break;
+        }
+        dst[n++] = c;
+    }
+    return n;
+}
+
+void send_byte(char ch){
+    putchar(ch);
+}
+
+size_t serial_write(const void* buf, size_t count){
+    return fwrite(buf, 1, count, stdout);
+}
+
+size_t serial_writev(const struct fio_iovec_t* iov, int iovcnt){
+    size_t count = 0;
+
+    for(int i = 0; i < iovcnt; i++)
+        count += fwrite(iov[i].base, 1, iov[i].len, stdout);
+    return count;
+}
@@ -0,0 +1,14 @@
+#include <stdlib.h>
+
+#include "FreeRTOS.h"
+
+/* The filesystem stack runs on the host's allocator. mmbench links one of
+ * the target heaps from portable/MemMang instead of this file. */
+
+void *pvPortMalloc(size_t xWantedSize){
+    return malloc(xWantedSize);
+}
+
+void vPortFree(void *pv){
+    free(pv);
+}
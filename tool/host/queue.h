@@ -0,0 +1,8 @@
+#ifndef __HOST_QUEUE_H__
+#define __HOST_QUEUE_H__
+
+#include "FreeRTOS.h"
+
+typedef void * xQueueHandle;
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef __HOST_SEMPHR_H__
+#define __HOST_SEMPHR_H__
+
+#include "FreeRTOS.h"
+#include "queue.h"
+
+typedef xQueueHandle xSemaphoreHandle;
+
+/* Counting semaphore with a ceiling, a mutex is a binary one that starts
+ * given. There is no priority inheritance on the host. */
+xSemaphoreHandle xHostSemaphoreCreate(unsigned portBASE_TYPE uxMaxCount, unsigned portBASE_TYPE uxInitialCount);
+signed portBASE_TYPE xHostSemaphoreTake(xSemaphoreHandle xSemaphore, portTickType xBlockTime);
+signed portBASE_TYPE xHostSemaphoreGive(xSemaphoreHandle xSemaphore);
+void vHostSemaphoreDelete(xSemaphoreHandle xSemaphore);
+
+#define xSemaphoreCreateMutex() xHostSemaphoreCreate(1, 1)
+#define vSemaphoreCreateBinary(xSemaphore) ((xSemaphore) = xHostSemaphoreCreate(1, 1))
+#define xSemaphoreCreateCounting(uxMaxCount, uxInitialCount) xHostSemaphoreCreate((uxMaxCount), (uxInitialCount))
+#define xSemaphoreTake(xSemaphore, xBlockTime) xHostSemaphoreTake((xSemaphore), (xBlockTime))
+#define xSemaphoreGive(xSemaphore) xHostSemaphoreGive(xSemaphore)
+#define xSemaphoreGiveFromISR(xSemaphore, pxWoken) xHostSemaphoreGive(xSemaphore)
+#define vQueueDelete(xQueue) vHostSemaphoreDelete(xQueue)
+
+#endif
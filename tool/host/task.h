@@ -0,0 +1,25 @@
+#ifndef __HOST_TASK_H__
+#define __HOST_TASK_H__
+
+#include "FreeRTOS.h"
+
+/* Critical sections and scheduler suspension both map to one recursive
+ * host mutex */
+void vHostEnterCritical(void);
+void vHostExitCritical(void);
+
+#define taskENTER_CRITICAL() vHostEnterCritical()
+#define taskEXIT_CRITICAL()  vHostExitCritical()
+
+/* Tasks are detached threads, priority and stack depth are ignored */
+typedef void * xTaskHandle;
+typedef void (*pdTASK_CODE)(void *);
+#define tskIDLE_PRIORITY ((unsigned portBASE_TYPE) 0)
+
+signed portBASE_TYPE xTaskCreate(pdTASK_CODE pvTaskCode, const signed char * pcName, unsigned short usStackDepth, void * pvParameters, unsigned portBASE_TYPE uxPriority, xTaskHandle * pxCreatedTask);
+void vTaskSuspendAll(void);
+signed portBASE_TYPE xTaskResumeAll(void);
+portTickType xTaskGetTickCount(void);
+void vTaskDelay(portTickType xTicksToDelay);
+
+#endif
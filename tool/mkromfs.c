@@ -7,9 +7,30 @@
 #include <stdint.h>
 #include <dirent.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #define hash_init 5381
 
+#define ROMFS_MAGIC 0x464D4F52 /* "ROMF" */
+#define ROMFS_VERSION 2
+
+/* Image layout, all integers little endian:
+ *   header
+ *   index[count]     (hash, record) pairs sorted by hash, then record
+ *   table[count]     struct romfs_file_t, record 0 is the root directory
+ *   data             per record: filename, then content
+ *
+ * A directory's content is its child count followed by the child hashes.
+ * Entries are visited in strcmp order so the output only depends on the
+ * directory contents. */
+struct romfs_header_t{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t table_offset;
+    uint32_t data_offset;
+};
+
 struct romfs_file_t{
     uint32_t hash;
     uint32_t filename_length;
@@ -18,6 +39,18 @@ struct romfs_file_t{
     uint32_t data_offset;
 }__attribute__((packed));
 
+struct romfs_node_t{
+    char fullpath[1024];
+    char name[256];
+    struct romfs_file_t file;
+    uint32_t child_count;
+    uint32_t* children;
+};
+
+static struct romfs_node_t* nodes = NULL;
+static uint32_t node_count = 0;
+static uint32_t node_capacity = 0;
+
 uint32_t hash_djb2(const uint8_t * str, uint32_t hash) {
     int c;
 
@@ -50,194 +83,123 @@ void write_romfs_file(FILE* outfile, struct romfs_file_t* file){
     return;
 }
 
-int processdir_table(DIR * dirp, const char * curpath, FILE * outfile, const char * prefix, int* data_offset, char* curr_dirname) {
-    char fullpath[1024];
-    struct dirent * ent;
-    DIR * rec_dirp;
-    uint32_t cur_hash = hash_djb2((const uint8_t *) curpath, hash_init);
-    FILE * infile;
-
-    struct romfs_file_t file;
-    uint32_t file_count = 0;
-    
-    //Create Dir node
-    while ((ent=readdir(dirp))){
-        if (strcmp(ent->d_name, ".") == 0)
-            continue;
-        if (strcmp(ent->d_name, "..") == 0)
-            continue;
-        file_count++;
+static uint32_t add_node(const char* fullpath, const char* name){
+    if (node_count == node_capacity) {
+        node_capacity = node_capacity ? node_capacity * 2 : 64;
+        nodes = realloc(nodes, sizeof(struct romfs_node_t) * node_capacity);
+        if (!nodes) {
+            perror("allocating nodes");
+            exit(-1);
+        }
     }
+    memset(nodes + node_count, 0, sizeof(struct romfs_node_t));
+    strcpy(nodes[node_count].fullpath, fullpath);
+    strcpy(nodes[node_count].name, name);
+    nodes[node_count].file.filename_length = strlen(name);
+    return node_count++;
+}
 
-    //hash = hash_djb2((const uint8_t *) curr_dirname, cur_hash);
-    
-    file.hash = cur_hash;
-    file.filename_length = strlen(curr_dirname);
-    file.attribute = 1; 
-    file.length = 4 + file_count * 4;
-    file.data_offset = *data_offset;
-
-    write_romfs_file(outfile, &file);
-    *data_offset += file.filename_length + 4 + file_count * 4;
-
-    printf("Adding %s | %s, %d, Offset %d: \n", curpath, curr_dirname, cur_hash, file.data_offset);
-
-    seekdir(dirp, 0);
-    while ((ent = readdir(dirp))) {
-        strcpy(fullpath, prefix);
-        strcat(fullpath, "/");
-        strcat(fullpath, curpath);
-        strcat(fullpath, ent->d_name);
-
-        if (ent->d_type != DT_DIR) {
-            file.hash = hash_djb2((const uint8_t *) ent->d_name, cur_hash);
-            file.filename_length = strlen(ent->d_name);
-            file.attribute = 0; 
-
-            infile = fopen(fullpath, "rb");
-            if (!infile) {
-                perror("opening input file");
-                exit(-1);
-            }
-
-            fseek(infile, 0, SEEK_END);
-            file.length = ftell(infile);
-            fseek(infile, 0, SEEK_SET);
-
-            fclose(infile);
-
-            file.data_offset = *data_offset;
-            *data_offset += file.length + file.filename_length;
-           
-            write_romfs_file(outfile, &file);
+static int is_dir(const char* fullpath){
+    struct stat st;
 
-            printf("Adding %s, %d, Offset %d: \n", ent->d_name, file.hash, file.data_offset);
-        }
+    if (stat(fullpath, &st)) {
+        perror(fullpath);
+        exit(-1);
     }
+    return S_ISDIR(st.st_mode);
+}
 
-    seekdir(dirp, 0);
-    while ((ent = readdir(dirp))) {
-        strcpy(fullpath, prefix);
-        strcat(fullpath, "/");
-        strcat(fullpath, curpath);
-        strcat(fullpath, ent->d_name);
-        if (ent->d_type == DT_DIR) {
-            if (strcmp(ent->d_name, ".") == 0)
-                continue;
-            if (strcmp(ent->d_name, "..") == 0)
-                continue;
-            strcat(fullpath, "/");
-            rec_dirp = opendir(fullpath);
-            file_count += processdir_table(rec_dirp, fullpath + strlen(prefix) + 1, outfile, prefix, data_offset, ent->d_name);
-            closedir(rec_dirp);
-        }
-    }
-    
-    return file_count;
+static int filter_dots(const struct dirent * ent){
+    return strcmp(ent->d_name, ".") && strcmp(ent->d_name, "..");
 }
 
-int processdir_data(DIR * dirp, const char * curpath, FILE * outfile, const char * prefix, char* curr_dirname) {
-    char fullpath[1024];
-    char buf[16 * 1024];
-    struct dirent * ent;
-    DIR * rec_dirp;
+static int compare_names(const struct dirent ** a, const struct dirent ** b){
+    return strcmp((*a)->d_name, (*b)->d_name);
+}
+
+/* curpath is relative to the image root and ends with '/' unless empty */
+void processdir(const char * fullpath, const char * curpath, const char * curr_dirname) {
+    char path[1024];
+    struct dirent ** ents;
     uint32_t cur_hash = hash_djb2((const uint8_t *) curpath, hash_init);
-    uint32_t size, w, hash;
+    uint32_t dir, node;
     FILE * infile;
-    
-    uint32_t file_count = 0;
-    
-    while ((ent=readdir(dirp))){
-        if (strcmp(ent->d_name, ".") == 0)
-            continue;
-        if (strcmp(ent->d_name, "..") == 0)
-            continue;
-        file_count++;
+    int n;
+
+    n = scandir(fullpath, &ents, filter_dots, compare_names);
+    if (n < 0) {
+        perror(fullpath);
+        exit(-1);
     }
 
-    printf("Encoding %s, count : %d\n", curpath, file_count);
+    dir = add_node(fullpath, curr_dirname);
+    nodes[dir].file.hash = cur_hash;
+    nodes[dir].file.attribute = 1;
+    nodes[dir].file.length = 4 + n * 4;
+    nodes[dir].child_count = n;
+    nodes[dir].children = calloc(n ? n : 1, sizeof(uint32_t));
 
-    fwrite(curr_dirname, 1, strlen(curr_dirname), outfile);
-    reverse_fwrite(outfile, file_count);
+    printf("Adding %s | %s, %u\n", curpath, curr_dirname, cur_hash);
 
-    seekdir(dirp, 0);
-    while ((ent = readdir(dirp))) {
-        if (strcmp(ent->d_name, ".") == 0)
+    /* Files first, then recurse into directories */
+    for (int i = 0; i < n; i++) {
+        snprintf(path, sizeof(path), "%s/%s", fullpath, ents[i]->d_name);
+        if (is_dir(path)) {
+            nodes[dir].children[i] = hash_djb2((const uint8_t*)"/", hash_djb2((const uint8_t*) ents[i]->d_name, cur_hash));
             continue;
-        if (strcmp(ent->d_name, "..") == 0)
-            continue;
-        if(ent->d_type == DT_DIR){
-            hash = hash_djb2((const uint8_t*)"/", hash_djb2((const uint8_t*) ent->d_name, cur_hash));  //A tailing / due to it's a directory
-            reverse_fwrite(outfile, hash);
-        }else{
-            hash = hash_djb2((const uint8_t *) ent->d_name, cur_hash);
-            printf("Linking %s, %d, %d\n",ent->d_name ,cur_hash, hash);
-            reverse_fwrite(outfile, hash);
-        } 
-    }
+        }
 
-    seekdir(dirp, 0);
-    while ((ent = readdir(dirp))) {
-        strcpy(fullpath, prefix);
-        strcat(fullpath, "/");
-        strcat(fullpath, curpath);
-        strcat(fullpath, ent->d_name);
-        if (ent->d_type != DT_DIR) {
-            fwrite(ent->d_name, 1, strlen(ent->d_name), outfile);
-
-            infile = fopen(fullpath, "rb");
-            if (!infile) {
-                perror("opening input file");
-                exit(-1);
-            }
+        node = add_node(path, ents[i]->d_name);
+        nodes[node].file.hash = hash_djb2((const uint8_t *) ents[i]->d_name, cur_hash);
+        nodes[node].file.attribute = 0;
+        nodes[dir].children[i] = nodes[node].file.hash;
 
-            fseek(infile, 0, SEEK_END);
-            size = ftell(infile);
-            fseek(infile, 0, SEEK_SET);
-            while (size) {
-                w = size > 16 * 1024 ? 16 * 1024 : size;
-                fread(buf, 1, w, infile);
-                fwrite(buf, 1, w, outfile);
-                size -= w;
-            }
-            fclose(infile);
+        infile = fopen(path, "rb");
+        if (!infile) {
+            perror("opening input file");
+            exit(-1);
         }
+        fseek(infile, 0, SEEK_END);
+        nodes[node].file.length = ftell(infile);
+        fclose(infile);
+
+        printf("Adding %s, %u\n", ents[i]->d_name, nodes[node].file.hash);
     }
 
-    seekdir(dirp, 0);
-    while ((ent = readdir(dirp))) {
-        strcpy(fullpath, prefix);
-        strcat(fullpath, "/");
-        strcat(fullpath, curpath);
-        strcat(fullpath, ent->d_name);
+    for (int i = 0; i < n; i++) {
+        char subpath[1024];
 
-        if (strcmp(ent->d_name, ".") == 0)
-	    continue;
-        if (strcmp(ent->d_name, "..") == 0)
-            continue;
-        if (ent->d_type == DT_DIR) {
-            strcat(fullpath, "/");
-            rec_dirp = opendir(fullpath);
-            processdir_data(rec_dirp, fullpath + strlen(prefix) + 1, outfile, prefix, ent->d_name);
-            closedir(rec_dirp);
+        snprintf(path, sizeof(path), "%s/%s", fullpath, ents[i]->d_name);
+        if (is_dir(path)) {
+            snprintf(subpath, sizeof(subpath), "%s%s/", curpath, ents[i]->d_name);
+            processdir(path, subpath, ents[i]->d_name);
         }
     }
 
-    return 0;
+    for (int i = 0; i < n; i++)
+        free(ents[i]);
+    free(ents);
 }
+
+static int compare_index(const void * a, const void * b){
+    const uint32_t * x = (const uint32_t *) a;
+    const uint32_t * y = (const uint32_t *) b;
+
+    if (nodes[*x].file.hash != nodes[*y].file.hash)
+        return nodes[*x].file.hash < nodes[*y].file.hash ? -1 : 1;
+    return (*x > *y) - (*x < *y);
+}
+
 int main(int argc, char ** argv) {
     char * binname = *argv++;
     char buf[16 * 1024];
     char * o;
     char * outname = NULL;
-    char out_table_name[2048];
-    char out_data_name[2048];
     char * dirname = ".";
     FILE * outfile;
-    FILE * outfile_table;
-    FILE * outfile_data;
-    DIR * dirp;
-    uint32_t w, size;
+    FILE * infile;
+    uint32_t * index;
+    uint32_t data_offset, w, size;
 
     while ((o = *argv++)) {
         if (*o == '-') {
@@ -259,71 +221,75 @@ int main(int argc, char ** argv) {
 
     if (!outname)
         outfile = stdout;
-    else{
+    else
         outfile = fopen(outname, "wb");
-        strcpy(out_table_name, outname);
-        strcpy(out_data_name, outname);
-        strcat(out_table_name, ".table");
-        strcat(out_data_name, ".data");
-        outfile_table = fopen(out_table_name, "wb");
-        outfile_data = fopen(out_data_name, "wb");
-    }
 
     if (!outfile) {
         perror("opening output file");
         exit(-1);
     }
 
-    dirp = opendir(dirname);
-    if (!dirp) {
-        perror("opening directory");
-        exit(-1);
-    }
-
-    int data_offset = 0;
-    int n = processdir_table(dirp, "", outfile_table, dirname, &data_offset, "");
-    
-    seekdir(dirp, 0);
+    processdir(dirname, "", "");
 
-    processdir_data(dirp, "", outfile_data, dirname, "");
-    if (outname){
-        fclose(outfile_table);
-        fclose(outfile_data);
+    data_offset = 0;
+    for (uint32_t i = 0; i < node_count; i++) {
+        nodes[i].file.data_offset = data_offset;
+        data_offset += nodes[i].file.filename_length + nodes[i].file.length;
     }
 
-    outfile_table = fopen(out_table_name, "rb");
-    outfile_data = fopen(out_data_name, "rb");
+    index = calloc(node_count, sizeof(uint32_t));
+    for (uint32_t i = 0; i < node_count; i++)
+        index[i] = i;
+    qsort(index, node_count, sizeof(uint32_t), compare_index);
 
-    reverse_fwrite(outfile, n + 1); //root dir
-    
-    fseek(outfile_table, 0, SEEK_END);
-    size = ftell(outfile_table);
-    fseek(outfile_table, 0, SEEK_SET);
+    reverse_fwrite(outfile, ROMFS_MAGIC);
+    reverse_fwrite(outfile, ROMFS_VERSION);
+    reverse_fwrite(outfile, node_count);
+    reverse_fwrite(outfile, sizeof(struct romfs_header_t) + node_count * 8);
+    reverse_fwrite(outfile, sizeof(struct romfs_header_t) + node_count * 8 + node_count * sizeof(struct romfs_file_t));
 
-    while (size) {
-        w = size > 16 * 1024 ? 16 * 1024 : size;
-        fread(buf, 1, w, outfile_table);
-        fwrite(buf, 1, w, outfile);
-        size -= w;
+    for (uint32_t i = 0; i < node_count; i++) {
+        reverse_fwrite(outfile, nodes[index[i]].file.hash);
+        reverse_fwrite(outfile, index[i]);
     }
 
-    fseek(outfile_data, 0, SEEK_END);
-    size = ftell(outfile_data);
-    fseek(outfile_data, 0, SEEK_SET);
+    for (uint32_t i = 0; i < node_count; i++)
+        write_romfs_file(outfile, &nodes[i].file);
+
+    for (uint32_t i = 0; i < node_count; i++) {
+        fwrite(nodes[i].name, 1, nodes[i].file.filename_length, outfile);
+        if (nodes[i].file.attribute & 1) {
+            reverse_fwrite(outfile, nodes[i].child_count);
+            for (uint32_t j = 0; j < nodes[i].child_count; j++)
+                reverse_fwrite(outfile, nodes[i].children[j]);
+            continue;
+        }
 
-    while (size) {
-        w = size > 16 * 1024 ? 16 * 1024 : size;
-        fread(buf, 1, w, outfile_data);
-        fwrite(buf, 1, w, outfile);
-        size -= w;
+        infile = fopen(nodes[i].fullpath, "rb");
+        if (!infile) {
+            perror("opening input file");
+            exit(-1);
+        }
+        size = nodes[i].file.length;
+        while (size) {
+            w = size > 16 * 1024 ? 16 * 1024 : size;
+            if (fread(buf, 1, w, infile) != w) {
+                perror("reading input file");
+                exit(-1);
+            }
+            fwrite(buf, 1, w, outfile);
+            size -= w;
+        }
+        fclose(infile);
     }
 
-    if (outname){
+    if (outname)
         fclose(outfile);
-        fclose(outfile_table);
-        fclose(outfile_data);
-    }
-    closedir(dirp);
-    
+
+    for (uint32_t i = 0; i < node_count; i++)
+        free(nodes[i].children);
+    free(nodes);
+    free(index);
+
     return 0;
 }